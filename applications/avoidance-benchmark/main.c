@@ -0,0 +1,244 @@
+/*
+ * Avoidance benchmark
+ *
+ * Generate seeded random obstacle fields of increasing density, then time
+ * graph build, path search, whole graph update and collision checks.
+ * Results are printed as CSV lines, one per operation and density:
+ *   op,fixed,dynamic,samples,vertices,edges,mean_ns,p50_ns,p90_ns,p99_ns,max_ns
+ * vertices and edges are averaged over all fields of a density.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* RIOT includes */
+#include "periph/pm.h"
+#include "random.h"
+#include "xtimer.h"
+
+/* Project includes */
+#include "avoidance.h"
+
+#define BENCH_SEED              (2020)
+/* Random fields per density */
+#define BENCH_FIELDS            (16)
+/* Timed samples per field */
+#define BENCH_SAMPLES           (16)
+/* Calls per timed sample */
+#define BENCH_LOOPS             (8)
+/* Points checked per collision sample */
+#define BENCH_COLLISION_POINTS  (64)
+
+#define BENCH_FIXED_POLYGONS    (2)
+#define BENCH_DYN_POLYGONS_MAX  (POLY_MAX - BENCH_FIXED_POLYGONS)
+#define BENCH_DYN_POLYGONS_STEP (2)
+#define BENCH_RADIUS_MIN        (60)
+#define BENCH_RADIUS_MAX        (200)
+/* Tries to find a reachable finish position in a field */
+#define BENCH_FINISH_TRIES      (32)
+
+#define BENCH_SAMPLES_MAX       (BENCH_FIELDS * BENCH_SAMPLES)
+
+typedef enum {
+    BENCH_OP_BUILD = 0,
+    BENCH_OP_SEARCH,
+    BENCH_OP_UPDATE,
+    BENCH_OP_COLLISION,
+    BENCH_OP_COUNT,
+} bench_op_t;
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {
+    [BENCH_OP_BUILD] = "build",
+    [BENCH_OP_SEARCH] = "search",
+    [BENCH_OP_UPDATE] = "update",
+    [BENCH_OP_COLLISION] = "collision",
+};
+
+/* Time per operation of each sample, in ns */
+static uint32_t samples[BENCH_OP_COUNT][BENCH_SAMPLES_MAX];
+static uint32_t samples_count[BENCH_OP_COUNT];
+
+static pose_t random_point(void)
+{
+    /* Borders can be negative */
+    pose_t p = {
+        .x = (AVOIDANCE_BORDER_X_MIN)
+             + (double)random_uint32_range(0, (AVOIDANCE_BORDER_X_MAX) - (AVOIDANCE_BORDER_X_MIN)),
+        .y = (AVOIDANCE_BORDER_Y_MIN)
+             + (double)random_uint32_range(0, (AVOIDANCE_BORDER_Y_MAX) - (AVOIDANCE_BORDER_Y_MIN)),
+        .O = 0,
+    };
+
+    return p;
+}
+
+/* Random regular counterclockwise polygon */
+static polygon_t random_polygon(void)
+{
+    polygon_t polygon;
+    pose_t center = random_point();
+    double radius = random_uint32_range(BENCH_RADIUS_MIN, BENCH_RADIUS_MAX);
+    double angle = random_uint32_range(0, 360) * M_PI / 180;
+
+    polygon.count = random_uint32_range(4, POLY_MAX_POINTS + 1);
+    for (int i = 0; i < polygon.count; i++) {
+        double a = angle + (2 * M_PI * i) / polygon.count;
+        polygon.points[i].x = center.x + radius * cos(a);
+        polygon.points[i].y = center.y + radius * sin(a);
+        polygon.points[i].O = 0;
+    }
+
+    return polygon;
+}
+
+/* Fill dynamic obstacles and find start and finish positions the graph can be
+ * updated with, return -1 if none has been found */
+static int random_field(int nb_dyn_polygons, pose_t *start, pose_t *finish)
+{
+    reset_dyn_polygons();
+
+    for (int i = 0; i < nb_dyn_polygons; i++) {
+        polygon_t polygon = random_polygon();
+        add_dyn_polygon(&polygon);
+    }
+
+    *start = random_point();
+    for (int i = 0; i < BENCH_FINISH_TRIES; i++) {
+        *finish = random_point();
+        if (update_graph(start, finish) >= 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static void add_sample(bench_op_t op, uint32_t start_us, uint32_t calls)
+{
+    uint32_t elapsed_us = xtimer_now_usec() - start_us;
+
+    samples[op][samples_count[op]++] = (uint32_t)(((uint64_t)elapsed_us * 1000) / calls);
+}
+
+static void bench_field(const pose_t *start, const pose_t *finish)
+{
+    pose_t points[BENCH_COLLISION_POINTS];
+
+    for (int i = 0; i < BENCH_COLLISION_POINTS; i++) {
+        points[i] = random_point();
+    }
+
+    for (int s = 0; s < BENCH_SAMPLES; s++) {
+        uint32_t t;
+
+        t = xtimer_now_usec();
+        for (int i = 0; i < BENCH_LOOPS; i++) {
+            build_avoidance_graph();
+        }
+        add_sample(BENCH_OP_BUILD, t, BENCH_LOOPS);
+
+        t = xtimer_now_usec();
+        for (int i = 0; i < BENCH_LOOPS; i++) {
+            dijkstra(AVOIDANCE_FINISH_INDEX);
+        }
+        add_sample(BENCH_OP_SEARCH, t, BENCH_LOOPS);
+
+        t = xtimer_now_usec();
+        for (int i = 0; i < BENCH_LOOPS; i++) {
+            update_graph(start, finish);
+        }
+        add_sample(BENCH_OP_UPDATE, t, BENCH_LOOPS);
+
+        t = xtimer_now_usec();
+        for (int i = 0; i < BENCH_COLLISION_POINTS; i++) {
+            check_polygon_collision(&points[i]);
+        }
+        add_sample(BENCH_OP_COLLISION, t, BENCH_COLLISION_POINTS);
+    }
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, uint32_t count, uint32_t pct)
+{
+    return sorted[((count - 1) * pct) / 100];
+}
+
+static void print_results(int nb_dyn_polygons, uint32_t vertices, uint32_t edges)
+{
+    for (int op = 0; op < BENCH_OP_COUNT; op++) {
+        uint32_t count = samples_count[op];
+        uint64_t sum = 0;
+
+        if (count == 0) {
+            continue;
+        }
+
+        qsort(samples[op], count, sizeof(uint32_t), compare_samples);
+        for (uint32_t i = 0; i < count; i++) {
+            sum += samples[op][i];
+        }
+
+        printf("%s,%d,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+               bench_op_names[op], BENCH_FIXED_POLYGONS, nb_dyn_polygons,
+               (unsigned long)count, (unsigned long)vertices, (unsigned long)edges,
+               (unsigned long)(sum / count),
+               (unsigned long)percentile(samples[op], count, 50),
+               (unsigned long)percentile(samples[op], count, 90),
+               (unsigned long)percentile(samples[op], count, 99),
+               (unsigned long)samples[op][count - 1]);
+    }
+}
+
+int main(void)
+{
+    random_init(BENCH_SEED);
+
+    for (int i = 0; i < BENCH_FIXED_POLYGONS; i++) {
+        polygon_t polygon = random_polygon();
+        add_polygon(&polygon);
+    }
+
+    printf("# seed=%u\n", BENCH_SEED);
+    printf("op,fixed,dynamic,samples,vertices,edges,mean_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+
+    for (int nb_dyn_polygons = 0; nb_dyn_polygons <= BENCH_DYN_POLYGONS_MAX;
+         nb_dyn_polygons += BENCH_DYN_POLYGONS_STEP) {
+        uint32_t vertices = 0;
+        uint32_t edges = 0;
+        uint32_t fields = 0;
+
+        for (int op = 0; op < BENCH_OP_COUNT; op++) {
+            samples_count[op] = 0;
+        }
+
+        for (int f = 0; f < BENCH_FIELDS; f++) {
+            pose_t start, finish;
+
+            if (random_field(nb_dyn_polygons, &start, &finish) < 0) {
+                continue;
+            }
+            vertices += avoidance_get_vertices_count();
+            edges += avoidance_get_edges_count();
+            fields++;
+
+            bench_field(&start, &finish);
+        }
+
+        if (fields) {
+            print_results(nb_dyn_polygons, vertices / fields, edges / fields);
+        }
+    }
+
+    printf("# done\n");
+
+    pm_off();
+
+    return 0;
+}
@@ -55,24 +55,6 @@ void app_calib_read_sensors(pca9548_t dev)
     }
 }
 
-static void app_vl53l0x_reset(void)
-{
-    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
-        pca9548_set_current_channel(PCA9548_SENSORS, vl53l0x_channel[dev]);
-        if (vl53l0x_reset_dev(dev) != 0)
-            DEBUG("ERROR: Sensor %u reset failed !!!\n", dev);
-    }
-}
-
-static void app_vl53l0x_init(void)
-{
-    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
-        pca9548_set_current_channel(PCA9548_SENSORS, vl53l0x_channel[dev]);
-        if (vl53l0x_init_dev(dev) != 0)
-            DEBUG("ERROR: Sensor %u init failed !!!\n", dev);
-    }
-}
-
 static void app_fixed_obstacles_init(void) {
 }
 
@@ -140,8 +122,8 @@ void app_front_cup_ramp(void)
     sd21_servo_reach_position(APP_SERVO_FC_ELEVATOR, APP_SERVO_STATE_ELEVATOR_BOTTOM);
     sd21_servo_reach_position(APP_SERVO_FR_ELEVATOR, APP_SERVO_STATE_ELEVATOR_BOTTOM);
 
-    app_vl53l0x_reset();
-    app_vl53l0x_init();
+    pf_vl53l0x_reset();
+    pf_vl53l0x_init();
 }
 
 void app_back_cup_take(void)
@@ -189,8 +171,8 @@ void app_back_cup_ramp(void)
     sd21_servo_reach_position(APP_SERVO_BC_ELEVATOR, APP_SERVO_STATE_ELEVATOR_BOTTOM);
     sd21_servo_reach_position(APP_SERVO_BR_ELEVATOR, APP_SERVO_STATE_ELEVATOR_BOTTOM);
 
-    app_vl53l0x_reset();
-    app_vl53l0x_init();
+    pf_vl53l0x_reset();
+    pf_vl53l0x_init();
 }
 
 
@@ -27,5 +27,6 @@ static const ctrl_quadpid_parameters_t ctrl_quadpid_params = {
 
         .min_distance_for_angular_switch = 3,   // mm,
         .min_angle_for_pose_reached = 2,        // deg,
+        .path_lookahead_distance = 100,         // mm,
         .regul = CTRL_REGUL_POSE_DIST,
 };
@@ -1,5 +1,15 @@
 #include "periph/i2c.h"
 
+#include "board.h"
+
+/* Channels enabled on emulated PCA9548 sensors I2C switch */
+static uint8_t switch_channels = 0;
+
+uint8_t native_i2c_get_switch_channels(void)
+{
+    return switch_channels;
+}
+
 void i2c_init(i2c_t dev) {
     (void)dev;
 }
@@ -27,11 +37,14 @@ int i2c_read_bytes(i2c_t dev, uint16_t addr,
 
 int i2c_write_bytes(i2c_t dev, uint16_t addr, const void *data,
                     size_t len, uint8_t flags) {
-    (void)dev;
-    (void)addr;
-    (void)data;
-    (void)len;
     (void)flags;
 
+    /* PCA9548 control register is its only byte */
+    if ((dev == pca9548_config[PCA9548_SENSORS].i2c_dev_id)
+        && (addr == pca9548_config[PCA9548_SENSORS].i2c_address)
+        && (len == 1)) {
+        switch_channels = *(const uint8_t *)data;
+    }
+
     return 0;
 }
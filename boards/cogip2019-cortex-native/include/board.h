@@ -64,6 +64,13 @@ extern "C" {
 #define QDEC_LEFT_POLARITY  1
 #define QDEC_RIGHT_POLARITY 1
 
+/**
+ * @brief Get channels enabled on emulated sensors I2C switch
+ *
+ * @return                      Bitmask of enabled channels
+ */
+uint8_t native_i2c_get_switch_channels(void);
+
 /**
  * @name    LED handlers
  * @{
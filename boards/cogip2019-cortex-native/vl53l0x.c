@@ -27,14 +27,77 @@
 
 uint16_t *shm_ptr = NULL;
 
+/* Emulated sensors moved from default I2C address to their configured one */
+static uint8_t addressed[VL53L0X_NUMOF];
+
+static uint16_t get_address(vl53l0x_t dev)
+{
+    return addressed[dev] ? vl53l0x_config[dev].i2c_addr : VL53L0X_DEFAULT_ADDR;
+}
+
+/* Sensor answers on address if it is the only one on enabled switch
+ * channels with that address */
+static int is_reachable(vl53l0x_t dev, uint16_t addr)
+{
+    uint8_t channels = native_i2c_get_switch_channels();
+    int count = 0;
+
+    if (!(channels & (1 << vl53l0x_channel[dev])) || (get_address(dev) != addr)) {
+        return 0;
+    }
+
+    for (vl53l0x_t i = 0; i < VL53L0X_NUMOF; i++) {
+        if ((channels & (1 << vl53l0x_channel[i])) && (get_address(i) == addr)) {
+            count++;
+        }
+    }
+
+    if (count > 1) {
+        printf("VL53L0X I2C address 0x%x collision !\n", addr);
+        return 0;
+    }
+
+    return 1;
+}
+
 int vl53l0x_init_dev(vl53l0x_t dev)
 {
-    (void) dev;
+    return is_reachable(dev, vl53l0x_config[dev].i2c_addr) ? 0 : -1;
+}
+
+int vl53l0x_set_profile(vl53l0x_t dev, vl53l0x_profile_t profile)
+{
+    assert(profile < VL53L0X_PROFILE_NUMOF);
+
+    return is_reachable(dev, vl53l0x_config[dev].i2c_addr) ? 0 : -1;
+}
+
+uint32_t vl53l0x_get_timing_budget(vl53l0x_t dev)
+{
+    (void)dev;
+
+    /* Simulated measures are read as soon as they are set */
+    return 0;
+}
+
+int vl53l0x_set_address(vl53l0x_t dev)
+{
+    if (!is_reachable(dev, VL53L0X_DEFAULT_ADDR)) {
+        return -1;
+    }
+
+    addressed[dev] = 1;
+
     return 0;
 }
 
 int vl53l0x_reset_dev(vl53l0x_t dev) {
-    (void) dev;
+    if (!is_reachable(dev, get_address(dev))) {
+        return -1;
+    }
+
+    addressed[dev] = 0;
+
     return 0;
 }
 
@@ -54,6 +117,11 @@ void vl53l0x_init(void)
 
 uint16_t vl53l0x_continuous_ranging_get_measure(vl53l0x_t dev)
 {
+    /* Sensor must be reachable on its own address */
+    if (!is_reachable(dev, vl53l0x_config[dev].i2c_addr)) {
+        return UINT16_MAX;
+    }
+
     /* Try to initialize shared memory if not already done */
     if(shm_ptr == NULL && pf_shm_key != 0) {
         int shmid = shmget(pf_shm_key, VL53L0X_NUMOF*sizeof(uint16_t), 0);
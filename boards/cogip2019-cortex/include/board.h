@@ -29,6 +29,9 @@ extern "C" {
 
 #define PCA9548_SENSORS 0
 
+/* Control loop timer, used with ctrl_timer option */
+#define CTRL_TIMER_DEV  TIMER_DEV(1)
+
 /* Camp selection */
 #define GPIO_CAMP       GPIO_PIN(PORT_B, 1)
 /* Starting switch */
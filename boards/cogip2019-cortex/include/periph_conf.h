@@ -80,10 +80,18 @@ static const timer_conf_t timer_config[] = {
         .rcc_mask = RCC_APB1ENR_TIM5EN,
         .bus = APB1,
         .irqn = TIM5_IRQn
+    },
+    {
+        .dev = TIM12,
+        .max = 0x0000ffff,
+        .rcc_mask = RCC_APB1ENR_TIM12EN,
+        .bus = APB1,
+        .irqn = TIM8_BRK_TIM12_IRQn
     }
 };
 
 #define TIMER_0_ISR     isr_tim5
+#define TIMER_1_ISR     isr_tim8_brk_tim12
 
 #define TIMER_NUMOF     (sizeof(timer_config) / sizeof(timer_config[0]))
 /** @} */
@@ -3,15 +3,75 @@
 #include "debug.h"
 #include "irq.h"
 #include "log.h"
+#include "mutex.h"
+#include "thread.h"
 #include "xtimer.h"
+#ifdef CTRL_TIMER
+#include "periph/timer.h"
+#endif
 
 /* Project includes */
 #include "ctrl.h"
+#include "trigonometry.h"
 #include "utils.h"
 #include "platform.h"
 
+/* Get setpoints buffer to fill, initialized from published one. Setters are
+ * serialized until ctrl_publish_setpoint(). */
+static ctrl_setpoint_t* ctrl_begin_setpoint(ctrl_t* ctrl)
+{
+    ctrl_setpoints_t *setpoints = &ctrl->control.setpoints;
+    unsigned int published;
+
+    mutex_lock(&setpoints->lock);
+
+    published = atomic_load_explicit(&setpoints->published, memory_order_relaxed);
+    setpoints->buffers[!published] = setpoints->buffers[published];
+
+    return &setpoints->buffers[!published];
+}
+
+/* Publish setpoints buffer filled since ctrl_begin_setpoint() */
+static void ctrl_publish_setpoint(ctrl_t* ctrl)
+{
+    ctrl_setpoints_t *setpoints = &ctrl->control.setpoints;
+    unsigned int published = atomic_load_explicit(&setpoints->published, memory_order_relaxed);
+
+    atomic_store_explicit(&setpoints->published, !published, memory_order_release);
+    atomic_fetch_add_explicit(&setpoints->sequence, 1, memory_order_release);
+
+    mutex_unlock(&setpoints->lock);
+}
+
+/* Copy published setpoints and return their sequence, only called by
+ * control loop */
+static unsigned int ctrl_get_setpoint(ctrl_t* ctrl, ctrl_setpoint_t *setpoint)
+{
+    ctrl_setpoints_t *setpoints = &ctrl->control.setpoints;
+    unsigned int sequence;
+
+    /* Copy again if new setpoints were published meanwhile, as a setter may
+     * then be filling the copied buffer */
+    do {
+        sequence = atomic_load_explicit(&setpoints->sequence, memory_order_acquire);
+        *setpoint = setpoints->buffers[atomic_load_explicit(&setpoints->published, memory_order_acquire)];
+    } while (sequence != atomic_load_explicit(&setpoints->sequence, memory_order_acquire));
+
+    return sequence;
+}
+
 void ctrl_set_pose_reached(ctrl_t* ctrl)
 {
+    /* Other threads mark last pose order set, it is applied after it */
+    if (thread_getpid() != ctrl->control.thread_pid) {
+        ctrl_setpoint_t *setpoint = ctrl_begin_setpoint(ctrl);
+
+        setpoint->pose_reached_count++;
+
+        ctrl_publish_setpoint(ctrl);
+        return;
+    }
+
     if (ctrl->control.pose_reached) {
         return;
     }
@@ -26,12 +86,52 @@ uint32_t ctrl_get_current_cycle(ctrl_t* ctrl)
     return ctrl->control.current_cycle;
 }
 
+inline const ctrl_timing_t* ctrl_get_timing(ctrl_t* ctrl)
+{
+    return &ctrl->control.timing;
+}
+
+inline void ctrl_reset_timing(ctrl_t* ctrl)
+{
+    ctrl->control.timing.reset = TRUE;
+}
+
+int ctrl_set_period(ctrl_t* ctrl, uint32_t period)
+{
+    if ((period < CTRL_PERIOD_MIN) || (period > CTRL_PERIOD_MAX)) {
+        LOG_ERROR("ctrl: Period %"PRIu32" us out of limits\n", period);
+        return -1;
+    }
+
+    DEBUG("ctrl: New period: %"PRIu32" us\n", period);
+
+    /* Next turns are scheduled with new period */
+    ctrl->control.period = period;
+
+    return 0;
+}
+
+inline uint32_t ctrl_get_period(ctrl_t* ctrl)
+{
+    return ctrl->control.period;
+}
+
+inline double ctrl_get_dt(ctrl_t* ctrl)
+{
+    return ctrl->control.dt;
+}
+
 inline void ctrl_set_pose_intermediate(ctrl_t* ctrl, uint8_t intermediate)
 {
     if (intermediate)
         DEBUG("ctrl: Next pose is intermediate\n");
 
-    ctrl->control.pose_intermediate = intermediate;
+    ctrl_setpoint_t *setpoint = ctrl_begin_setpoint(ctrl);
+
+    setpoint->pose_intermediate = intermediate;
+    setpoint->pose_intermediate_count++;
+
+    ctrl_publish_setpoint(ctrl);
 }
 
 inline uint8_t ctrl_is_pose_intermediate(ctrl_t* ctrl)
@@ -56,7 +156,13 @@ inline uint8_t ctrl_get_anti_blocking_on(ctrl_t* ctrl)
 
 inline uint8_t ctrl_is_pose_reached(ctrl_t* ctrl)
 {
-    return ctrl->control.pose_reached;
+    ctrl_setpoints_t *setpoints = &ctrl->control.setpoints;
+    unsigned int applied = atomic_load_explicit(&setpoints->applied, memory_order_acquire);
+
+    /* Flag may still be set for previous pose order until new setpoints
+     * are applied */
+    return ctrl->control.pose_reached
+        && (applied == atomic_load_explicit(&setpoints->sequence, memory_order_acquire));
 }
 
 inline void ctrl_set_pose_current(ctrl_t* const ctrl, const pose_t* pose_current)
@@ -64,9 +170,12 @@ inline void ctrl_set_pose_current(ctrl_t* const ctrl, const pose_t* pose_current
     DEBUG("ctrl: New pose current: x=%lf, y=%lf, O=%lf\n",
             pose_current->x, pose_current->y, pose_current->O);
 
-    irq_disable();
-    ctrl->control.pose_current = *pose_current;
-    irq_enable();
+    ctrl_setpoint_t *setpoint = ctrl_begin_setpoint(ctrl);
+
+    setpoint->pose_current = *pose_current;
+    setpoint->pose_current_count++;
+
+    ctrl_publish_setpoint(ctrl);
 }
 
 inline const pose_t* ctrl_get_pose_current(ctrl_t* ctrl)
@@ -74,20 +183,111 @@ inline const pose_t* ctrl_get_pose_current(ctrl_t* ctrl)
     return &ctrl->control.pose_current;
 }
 
+/* Add current pose to pose history, only called by control loop.
+ * Newest sample is replaced until it is CTRL_POSE_HISTORY_INTERVAL after the
+ * previous one, so history time span does not depend on loop period. */
+static void ctrl_record_pose(ctrl_t* ctrl, uint32_t timestamp)
+{
+    ctrl_pose_history_t *history = &ctrl->control.pose_history;
+    uint8_t newest = (history->index + CTRL_POSE_HISTORY_SIZE - 1) % CTRL_POSE_HISTORY_SIZE;
+    uint8_t previous = (history->index + CTRL_POSE_HISTORY_SIZE - 2) % CTRL_POSE_HISTORY_SIZE;
+
+    atomic_fetch_add_explicit(&history->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if ((history->count < 2)
+        || ((history->samples[newest].timestamp - history->samples[previous].timestamp)
+            >= CTRL_POSE_HISTORY_INTERVAL)) {
+        newest = history->index;
+        history->index = (history->index + 1) % CTRL_POSE_HISTORY_SIZE;
+        history->count = MIN(history->count + 1, CTRL_POSE_HISTORY_SIZE);
+    }
+
+    history->samples[newest] = (ctrl_pose_sample_t){
+        .pose = ctrl->control.pose_current,
+        .timestamp = timestamp,
+    };
+
+    atomic_fetch_add_explicit(&history->sequence, 1, memory_order_release);
+}
+
+/* Find samples around timestamp, from newest to oldest.
+ * Return 0 if timestamp is not older than pose history. */
+static int ctrl_find_poses_at(const ctrl_pose_history_t *history, uint32_t timestamp,
+                              ctrl_pose_sample_t *before, ctrl_pose_sample_t *after)
+{
+    int index = history->index;
+
+    for (int i = 0; i < history->count; i++) {
+        index = (index + CTRL_POSE_HISTORY_SIZE - 1) % CTRL_POSE_HISTORY_SIZE;
+        *before = history->samples[index];
+        if (i == 0) {
+            *after = *before;
+        }
+
+        if ((int32_t)(timestamp - before->timestamp) >= 0) {
+            return 0;
+        }
+
+        *after = *before;
+    }
+
+    return -1;
+}
+
+int ctrl_get_pose_at(ctrl_t* ctrl, uint32_t timestamp, pose_t* pose)
+{
+    ctrl_pose_history_t *history = &ctrl->control.pose_history;
+    ctrl_pose_sample_t before, after;
+    unsigned int sequence;
+    uint8_t count;
+    int res;
+
+    /* Read again if control loop wrote history meanwhile */
+    do {
+        sequence = atomic_load_explicit(&history->sequence, memory_order_acquire);
+        count = history->count;
+        res = ctrl_find_poses_at(history, timestamp, &before, &after);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1)
+             || (sequence != atomic_load_explicit(&history->sequence, memory_order_relaxed)));
+
+    if (count == 0) {
+        *pose = ctrl->control.pose_current;
+        return -1;
+    }
+
+    /* Timestamp out of pose history */
+    if (before.timestamp == after.timestamp) {
+        *pose = before.pose;
+        return res;
+    }
+
+    double ratio = (double)(timestamp - before.timestamp)
+                   / (double)(after.timestamp - before.timestamp);
+
+    pose->x = before.pose.x + ratio * (after.pose.x - before.pose.x);
+    pose->y = before.pose.y + ratio * (after.pose.y - before.pose.y);
+    pose->O = limit_angle_deg(before.pose.O
+                              + ratio * limit_angle_deg(after.pose.O - before.pose.O));
+
+    return res;
+}
+
 inline void ctrl_set_pose_to_reach(ctrl_t* ctrl, const pose_t* pose_order)
 {
     DEBUG("ctrl: New pose to reach: x=%lf, y=%lf, O=%lf\n",
             pose_order->x, pose_order->y, pose_order->O);
 
-    irq_disable();
+    ctrl_setpoint_t *setpoint = ctrl_begin_setpoint(ctrl);
+    uint8_t changed = !pose_equal(&setpoint->pose_order, pose_order);
 
-    if (!pose_equal(&ctrl->control.pose_order, pose_order)) {
-        ctrl->control.blocking_cycles = 0;
-        ctrl->control.pose_order = *pose_order;
-        ctrl->control.pose_reached = FALSE;
+    if (changed) {
+        setpoint->pose_order = *pose_order;
+        setpoint->pose_order_count++;
     }
 
-    irq_enable();
+    ctrl_publish_setpoint(ctrl);
 }
 
 inline const pose_t* ctrl_get_pose_to_reach(ctrl_t* ctrl)
@@ -95,6 +295,37 @@ inline const pose_t* ctrl_get_pose_to_reach(ctrl_t* ctrl)
     return &ctrl->control.pose_order;
 }
 
+void ctrl_set_path_to_follow(ctrl_t* ctrl, const pose_t* poses, uint8_t count)
+{
+    ctrl_setpoint_t *setpoint = ctrl_begin_setpoint(ctrl);
+    ctrl_path_t *path_order = &setpoint->path_order;
+    uint8_t changed;
+
+    count = MIN(count, CTRL_PATH_MAX_POSES);
+
+    DEBUG("ctrl: New path to follow: %u poses\n", count);
+
+    changed = (count != path_order->count);
+    for (uint8_t i = 0; (i < count) && (!changed); i++) {
+        changed = !pose_equal(&path_order->poses[i], &poses[i]);
+    }
+
+    if (changed) {
+        for (uint8_t i = 0; i < count; i++) {
+            path_order->poses[i] = poses[i];
+        }
+        path_order->count = count;
+        setpoint->path_order_count++;
+    }
+
+    ctrl_publish_setpoint(ctrl);
+}
+
+inline const ctrl_path_t* ctrl_get_path_to_follow(ctrl_t* ctrl)
+{
+    return &ctrl->control.path_order;
+}
+
 inline const polar_t* ctrl_get_speed_current(ctrl_t* ctrl)
 {
     return &ctrl->control.speed_current;
@@ -105,11 +336,12 @@ inline void ctrl_set_speed_order(ctrl_t* ctrl, polar_t* speed_order)
     DEBUG("ctrl: New speed order: linear=%lf, angle=%lf\n",
             speed_order->distance, speed_order->angle);
 
-    irq_disable();
+    ctrl_setpoint_t *setpoint = ctrl_begin_setpoint(ctrl);
 
-    ctrl->control.speed_order = *speed_order;
+    setpoint->speed_order = *speed_order;
+    setpoint->speed_order_count++;
 
-    irq_enable();
+    ctrl_publish_setpoint(ctrl);
 }
 
 inline const polar_t* ctrl_get_speed_order(ctrl_t* ctrl)
@@ -137,17 +369,9 @@ void ctrl_compute_speed_order(ctrl_t* ctrl)
     }
 }
 
-void ctrl_set_mode(ctrl_t* ctrl, ctrl_mode_t new_mode)
+/* Switch controller mode, only called by control loop */
+static void ctrl_apply_mode(ctrl_t* ctrl, ctrl_mode_t new_mode)
 {
-    /* Ensure we don't set a non existant mode */
-    if (new_mode >= CTRL_MODE_NUMOF)  {
-        LOG_WARNING("ctrl: Unknown mode, stopping controller\n");
-        ctrl->control.current_mode = CTRL_MODE_STOP;
-        return;
-    }
-
-    irq_disable();
-
     if (new_mode != ctrl->control.current_mode) {
         ctrl->control.current_mode = new_mode;
 
@@ -166,6 +390,8 @@ void ctrl_set_mode(ctrl_t* ctrl, ctrl_mode_t new_mode)
             puts("CTRL_MODE_RUNNING_SPEED"); break;
         case CTRL_MODE_PASSTHROUGH:
             puts("CTRL_MODE_PASSTHROUGH"); break;
+        case CTRL_MODE_RUNNING_PATH:
+            puts("CTRL_MODE_RUNNING_PATH"); break;
         default:
             puts("<unknown>"); break;
         }
@@ -174,8 +400,81 @@ void ctrl_set_mode(ctrl_t* ctrl, ctrl_mode_t new_mode)
         /* Reset current cycle as current mode has changed */
         ctrl->control.current_cycle = 0;
     }
+}
 
-    irq_enable();
+void ctrl_set_mode(ctrl_t* ctrl, ctrl_mode_t new_mode)
+{
+    /* Ensure we don't set a non existant mode */
+    if (new_mode >= CTRL_MODE_NUMOF)  {
+        LOG_WARNING("ctrl: Unknown mode, stopping controller\n");
+        new_mode = CTRL_MODE_STOP;
+    }
+
+    /* Controllers switch mode by themselves on current turn, published mode
+     * is kept until a new one is set */
+    if (thread_getpid() == ctrl->control.thread_pid) {
+        ctrl_apply_mode(ctrl, new_mode);
+        return;
+    }
+
+    ctrl_setpoint_t *setpoint = ctrl_begin_setpoint(ctrl);
+
+    setpoint->mode = new_mode;
+    setpoint->mode_count++;
+
+    ctrl_publish_setpoint(ctrl);
+}
+
+/* Apply setpoints set since previous turn, only called by control loop */
+static void ctrl_apply_setpoints(ctrl_t* ctrl, ctrl_setpoint_t *applied)
+{
+    ctrl_setpoint_t setpoint;
+    ctrl_pose_history_t *history = &ctrl->control.pose_history;
+    unsigned int sequence = ctrl_get_setpoint(ctrl, &setpoint);
+
+    if (setpoint.mode_count != applied->mode_count) {
+        ctrl_apply_mode(ctrl, setpoint.mode);
+    }
+
+    if (setpoint.pose_current_count != applied->pose_current_count) {
+        ctrl->control.pose_current = setpoint.pose_current;
+
+        /* Previous poses are not consistent with the new one anymore */
+        atomic_fetch_add_explicit(&history->sequence, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        history->count = 0;
+        atomic_fetch_add_explicit(&history->sequence, 1, memory_order_release);
+    }
+
+    if (setpoint.pose_order_count != applied->pose_order_count) {
+        ctrl->control.pose_order = setpoint.pose_order;
+        ctrl->control.pose_reached = FALSE;
+        ctrl->control.blocking_cycles = 0;
+    }
+
+    if (setpoint.pose_reached_count != applied->pose_reached_count) {
+        ctrl->control.pose_reached = TRUE;
+    }
+
+    if (setpoint.pose_intermediate_count != applied->pose_intermediate_count) {
+        ctrl->control.pose_intermediate = setpoint.pose_intermediate;
+    }
+
+    if (setpoint.speed_order_count != applied->speed_order_count) {
+        ctrl->control.speed_order = setpoint.speed_order;
+    }
+
+    if (setpoint.path_order_count != applied->path_order_count) {
+        ctrl->control.path_order = setpoint.path_order;
+
+        /* Controllers restart path tracking from current pose */
+        ctrl->control.current_cycle = 0;
+    }
+
+    *applied = setpoint;
+
+    /* Flags above are consistent with published setpoints from now */
+    atomic_store_explicit(&ctrl->control.setpoints.applied, sequence, memory_order_release);
 }
 
 inline ctrl_mode_t ctrl_get_mode(ctrl_t* ctrl)
@@ -183,16 +482,123 @@ inline ctrl_mode_t ctrl_get_mode(ctrl_t* ctrl)
     return ctrl->control.current_mode;
 }
 
+#ifdef CTRL_TIMER
+#ifndef CTRL_TIMER_DEV
+#error "ctrl_timer option needs a CTRL_TIMER_DEV board timer"
+#endif
+
+/* Control loop timer frequency, one tick per microsecond */
+#define CTRL_TIMER_FREQ     US_PER_SEC
+
+/* Released by timer interrupt on each period */
+static mutex_t ctrl_timer_tick = MUTEX_INIT_LOCKED;
+/* Next timer interrupt time */
+static unsigned int ctrl_timer_next;
+
+static void ctrl_timer_cb(void *arg, int channel)
+{
+    ctrl_t *ctrl = (ctrl_t*)arg;
+
+    /* Next period starts from this one, not from interrupt latency */
+    ctrl_timer_next += ctrl_get_period(ctrl);
+    timer_set_absolute(CTRL_TIMER_DEV, channel, ctrl_timer_next);
+
+    mutex_unlock(&ctrl_timer_tick);
+}
+
+static void ctrl_timer_start(ctrl_t* ctrl)
+{
+    if (timer_init(CTRL_TIMER_DEV, CTRL_TIMER_FREQ, ctrl_timer_cb, ctrl) != 0) {
+        LOG_ERROR("ctrl: Control loop timer init failed\n");
+        return;
+    }
+
+    ctrl_timer_next = timer_read(CTRL_TIMER_DEV) + ctrl_get_period(ctrl);
+    timer_set_absolute(CTRL_TIMER_DEV, 0, ctrl_timer_next);
+}
+#endif /* CTRL_TIMER */
+
+/* Wait for next control loop turn */
+static void ctrl_wait_period(ctrl_t* ctrl, xtimer_ticks32_t *loop_start_time)
+{
+#ifdef CTRL_TIMER
+    (void)ctrl;
+    (void)loop_start_time;
+
+    /* Several missed periods only release one turn */
+    mutex_lock(&ctrl_timer_tick);
+#else
+    xtimer_periodic_wakeup(loop_start_time, ctrl_get_period(ctrl));
+#endif
+}
+
+/* Measure loop turn period, controllers integrate over it */
+static void ctrl_update_dt(ctrl_t* ctrl, uint32_t start)
+{
+    static uint32_t previous_start = 0;
+    ctrl_timing_t *timing = &ctrl->control.timing;
+    uint32_t period = ctrl_get_period(ctrl);
+    uint32_t dt = start - previous_start;
+
+    timing->period = dt;
+    previous_start = start;
+
+    /* First turn or long preemption, do not let controllers integrate
+     * over it */
+    if ((dt < period / 2) || (dt > period * 2)) {
+        dt = period;
+    }
+
+    ctrl->control.dt = (double)dt / CTRL_PERIOD_REFERENCE;
+}
+
+/* Measure loop turn execution time, and period extremes */
+static void ctrl_update_timing(ctrl_t* ctrl, uint32_t start, uint32_t end)
+{
+    ctrl_timing_t *timing = &ctrl->control.timing;
+
+    timing->exec_time = end - start;
+
+    if (timing->reset) {
+        timing->period_min = UINT32_MAX;
+        timing->period_max = 0;
+        timing->exec_time_max = 0;
+        timing->reset = FALSE;
+        return;
+    }
+
+    timing->period_min = MIN(timing->period_min, timing->period);
+    timing->period_max = MAX(timing->period_max, timing->period);
+    timing->exec_time_max = MAX(timing->exec_time_max, timing->exec_time);
+}
+
 void *task_ctrl_update(void *arg)
 {
     /* bot position on the 'table' (absolute position): */
     polar_t motor_command = { 0, 0 };
 
     ctrl_t *ctrl = (ctrl_t*)arg;
+    /* Last setpoints applied */
+    ctrl_setpoint_t setpoint = { 0 };
     DEBUG("ctrl: Controller started\n");
 
+    ctrl->control.thread_pid = thread_getpid();
+
+    /* First turn period is meaningless */
+    ctrl_reset_timing(ctrl);
+
+    xtimer_ticks32_t loop_start_time = xtimer_now();
+
+#ifdef CTRL_TIMER
+    ctrl_timer_start(ctrl);
+#endif
+
     for (;;) {
-        xtimer_ticks32_t loop_start_time = xtimer_now();
+        uint32_t pose_timestamp = xtimer_now_usec();
+
+        ctrl_update_dt(ctrl, pose_timestamp);
+
+        ctrl_apply_setpoints(ctrl, &setpoint);
 
         ctrl_mode_t current_mode = ctrl->control.current_mode;
 
@@ -202,6 +608,9 @@ void *task_ctrl_update(void *arg)
             pre_mode_cb(&ctrl->control.pose_current, &ctrl->control.speed_current, &motor_command);
         }
 
+        /* Pose is computed from encoders read at loop start */
+        ctrl_record_pose(ctrl, pose_timestamp);
+
         ctrl_mode_cb_t mode_cb = ctrl->conf->ctrl_mode_cb[current_mode];
 
         if (mode_cb) {
@@ -217,7 +626,9 @@ void *task_ctrl_update(void *arg)
         /* Current cycle finished */
         ctrl->control.current_cycle++;
 
-        xtimer_periodic_wakeup(&loop_start_time, THREAD_PERIOD_INTERVAL);
+        ctrl_update_timing(ctrl, pose_timestamp, xtimer_now_usec());
+
+        ctrl_wait_period(ctrl, &loop_start_time);
     }
 
     return 0;
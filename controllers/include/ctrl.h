@@ -55,11 +55,17 @@
 #pragma once
 
 /* Standard includes */
+#include <stdatomic.h>
 #include <stdint.h>
 
+/* RIOT includes */
+#include "mutex.h"
+#include "sched.h"
+
 /* Project includes */
 #include "odometry.h"
 #include "pid.h"
+#include "utils.h"
 
 /**
  * @brief   Pre-controller callback. Called before the controller process
@@ -87,6 +93,8 @@ typedef enum {
     CTRL_MODE_RUNNING,      /**< Move according to asked position */
     CTRL_MODE_RUNNING_SPEED,/**< Move according to asked speed  */
     CTRL_MODE_PASSTHROUGH,  /**< Direct control of motion, input is output */
+    CTRL_MODE_RUNNING_PATH, /**< Move according to asked position, going
+                                 through asked path poses without stopping */
     CTRL_MODE_NUMOF,        /**< Number of mode, never use it as an index */
 } ctrl_mode_t;
 
@@ -109,19 +117,142 @@ typedef struct ctrl_t ctrl_t;
  */
 typedef polar_t (*speed_order_cb_t)(ctrl_t* ctrl);
 
+/**
+ * @brief   Control loop period controllers gains, speeds and accelerations
+ *          are expressed with (us)
+ */
+#define CTRL_PERIOD_REFERENCE   THREAD_PERIOD_INTERVAL
+
+/**
+ * @brief   Control loop period limits (us)
+ */
+#define CTRL_PERIOD_MIN         (1U * US_PER_MS)
+#define CTRL_PERIOD_MAX         CTRL_PERIOD_REFERENCE
+
+/**
+ * @brief   Pose history samples interval (us), whatever the loop period is
+ */
+#define CTRL_POSE_HISTORY_INTERVAL  CTRL_PERIOD_REFERENCE
+
+/**
+ * @brief   Number of poses kept in pose history
+ *
+ * History covers 400ms, more than sensors latency: acquisition period and
+ * timing budget, then planner period before measures are used.
+ */
+#define CTRL_POSE_HISTORY_SIZE  20
+
+/**
+ * @brief   Maximum number of poses of a path to follow
+ */
+#define CTRL_PATH_MAX_POSES     8
+
+/**
+ * @brief   Path to follow before reaching pose order
+ */
+typedef struct {
+    pose_t poses[CTRL_PATH_MAX_POSES];  /**< Poses to go through */
+    uint8_t count;                      /**< Number of poses */
+} ctrl_path_t;
+
+/**
+ * @brief   Timestamped pose
+ */
+typedef struct {
+    pose_t pose;                /**< Pose */
+    uint32_t timestamp;         /**< Time the pose was computed (us) */
+} ctrl_pose_sample_t;
+
+/**
+ * @brief   Last poses computed by the control loop
+ *
+ * Newest sample is the current pose, older ones are about
+ * CTRL_POSE_HISTORY_INTERVAL apart.
+ *
+ * Written by the control loop only, so readers in other threads check the
+ * sequence number is even and did not change while they were reading.
+ */
+typedef struct {
+    ctrl_pose_sample_t samples[CTRL_POSE_HISTORY_SIZE]; /**< Poses ring */
+    uint8_t index;              /**< Next sample index in ring */
+    uint8_t count;              /**< Number of samples in ring */
+    atomic_uint sequence;       /**< Incremented before and after each
+                                     write */
+} ctrl_pose_history_t;
+
+/**
+ * @brief   Control loop timing, measured on each loop turn
+ */
+typedef struct {
+    uint32_t period;            /**< Time since previous turn start (us) */
+    uint32_t exec_time;         /**< Turn execution time (us) */
+    uint32_t period_min;        /**< Minimum period since reset (us) */
+    uint32_t period_max;        /**< Maximum period since reset (us) */
+    uint32_t exec_time_max;     /**< Maximum execution time since reset
+                                     (us) */
+    uint8_t reset;              /**< Set to reset minimum and maximum values
+                                     on next turn */
+} ctrl_timing_t;
+
+/**
+ * @brief   Setpoints given to the control loop
+ *
+ * Each setpoint has a counter incremented when it is set, so the control loop
+ * only applies the ones set since its previous turn.
+ */
+typedef struct {
+    pose_t pose_order;          /**< Position order */
+    polar_t speed_order;        /**< Speed order to reach the position */
+    pose_t pose_current;        /**< Pose to restart odometry from */
+    ctrl_mode_t mode;           /**< Controller mode */
+    ctrl_path_t path_order;     /**< Path to follow to the pose order */
+    uint8_t pose_intermediate;  /**< Pose order is not the final destination */
+    uint32_t pose_order_count;  /**< Pose order counter */
+    uint32_t speed_order_count; /**< Speed order counter */
+    uint32_t pose_current_count;/**< Current pose counter */
+    uint32_t mode_count;        /**< Mode counter */
+    uint32_t path_order_count;  /**< Path order counter */
+    uint32_t pose_intermediate_count; /**< Intermediate pose counter */
+    uint32_t pose_reached_count;/**< Pose order set as reached counter */
+} ctrl_setpoint_t;
+
+/**
+ * @brief   Setpoints double buffer
+ *
+ * Setters fill the buffer not published and publish it, one at a time. The
+ * control loop copies the published buffer at turn start and copies it again
+ * if an other one was published meanwhile, so it never waits for setters
+ * and interrupts are never masked.
+ *
+ * The setters lock only serializes setters between them, the control loop
+ * never takes it.
+ */
+typedef struct {
+    ctrl_setpoint_t buffers[2]; /**< Setpoints buffers */
+    atomic_uint published;      /**< Published buffer index */
+    atomic_uint sequence;       /**< Number of buffers published */
+    atomic_uint applied;        /**< Number of buffers published when
+                                     control loop last applied them */
+    mutex_t lock;               /**< Setters lock */
+} ctrl_setpoints_t;
+
 /**
  * @brief    Controller general structure
  */
 typedef struct {
     pose_t pose_order;          /**< Position order */
+    ctrl_path_t path_order;     /**< Path to follow to the pose order, in
+                                     CTRL_MODE_RUNNING_PATH mode */
     pose_t pose_current;        /**< Current position */
     polar_t speed_order;        /**< Speed order to reach the position */
     polar_t speed_current;      /**< Current speed reaching the position */
     speed_order_cb_t speed_order_cb; /**< Optional @ref speed_order_cb_t. */
 
-    uint8_t pose_reached;       /**< Boolean set when pose_order is reached */
+    uint8_t pose_reached;       /**< Boolean set when pose_order is reached,
+                                     only written by control loop */
     uint8_t pose_intermediate;  /**< Boolean set when current pose_order is
-                                     not the final destination */
+                                     not the final destination, only written
+                                     by control loop */
     uint8_t allow_reverse;      /**< Boolean to allow going backward to reach
                                      the pose_order */
     uint8_t anti_blocking_on;   /**< Continuous cycles number the controller is
@@ -134,6 +265,17 @@ typedef struct {
     uint32_t current_cycle;     /**< Count each control loop turn.
                                      Reset when a new controller mode is set,
                                      incremented on each loop turn otherwise */
+
+    ctrl_pose_history_t pose_history;   /**< Poses of last loop turns */
+
+    ctrl_timing_t timing;       /**< Control loop period and execution time */
+
+    ctrl_setpoints_t setpoints; /**< Setpoints waiting for next loop turn */
+    kernel_pid_t thread_pid;    /**< Control loop thread */
+
+    uint32_t period;            /**< Control loop period (us) */
+    double dt;                  /**< Current loop turn time step, in
+                                     CTRL_PERIOD_REFERENCE unit */
 } ctrl_control_t;
 
 /**
@@ -150,7 +292,9 @@ typedef struct {
     const uint16_t  blocking_speed_error_treshold;  /**< Blocking speed error
                                                          treshold */
     const uint16_t  blocking_cycles_max;            /**< Blocking cycles
-                                                         maximum number */
+                                                         maximum number, in
+                                                         CTRL_PERIOD_REFERENCE
+                                                         periods */
 } ctrl_platform_configuration_t;
 
 /**
@@ -193,6 +337,61 @@ struct ctrl_t {
  */
 uint32_t ctrl_get_current_cycle(ctrl_t* ctrl);
 
+/**
+ * @brief Get control loop timing
+ *
+ * @param[in] ctrl              Controller object
+ *
+ * @return                      Last turn period and execution time, and
+ *                              their extremes since last reset
+ */
+const ctrl_timing_t* ctrl_get_timing(ctrl_t* ctrl);
+
+/**
+ * @brief Reset control loop timing extremes on next loop turn
+ *
+ * @param[in] ctrl              Controller object
+ *
+ * @return
+ */
+void ctrl_reset_timing(ctrl_t* ctrl);
+
+/**
+ * @brief Set control loop period
+ *
+ * Controllers gains are given for CTRL_PERIOD_REFERENCE and scaled with
+ * measured time step, so they do not need to be tuned again.
+ *
+ * @param[in] ctrl              Controller object
+ * @param[in] period            Period (us), from CTRL_PERIOD_MIN to
+ *                              CTRL_PERIOD_MAX
+ *
+ * @return                      0 on success
+ * @return                      not 0 if period is out of limits
+ */
+int ctrl_set_period(ctrl_t* ctrl, uint32_t period);
+
+/**
+ * @brief Get control loop period
+ *
+ * @param[in] ctrl              Controller object
+ *
+ * @return                      Period (us)
+ */
+uint32_t ctrl_get_period(ctrl_t* ctrl);
+
+/**
+ * @brief Get current loop turn time step
+ *
+ * Measured time since previous loop turn, expected period if measure is
+ * meaningless (first turn, long preemption).
+ *
+ * @param[in] ctrl              Controller object
+ *
+ * @return                      Time step, in CTRL_PERIOD_REFERENCE unit
+ */
+double ctrl_get_dt(ctrl_t* ctrl);
+
 /**
  * @brief Set the pose order as an intermediate position
  *
@@ -245,6 +444,9 @@ uint8_t ctrl_get_anti_blocking_on(ctrl_t* ctrl);
 /**
  * @brief Up pose reached flag
  *
+ * From control loop, the pose order currently applied is reached. From other
+ * threads, the last pose order set is reached from next loop turn.
+ *
  * @param[in] ctrl              Controller object
  *
  * @return
@@ -254,6 +456,8 @@ void ctrl_set_pose_reached(ctrl_t* ctrl);
 /**
  * @brief Up pose reached flag
  *
+ * Pose is not reached until control loop applied the last setpoints.
+ *
  * @param[in] ctrl              Controller object
  *
  * @return                      0 if pose is not reached
@@ -264,6 +468,9 @@ uint8_t ctrl_is_pose_reached(ctrl_t* ctrl);
 /**
  * @brief Set pose order
  *
+ * Applied by the control loop on its next turn. Pose reached flag is cleared
+ * immediately if pose order changed.
+ *
  * @param[in] ctrl              Controller object
  * @param[in] pose_order        Pose to reach
  *
@@ -280,9 +487,37 @@ void ctrl_set_pose_to_reach(ctrl_t* ctrl, const pose_t* pose_order);
  */
 const pose_t* ctrl_get_pose_to_reach(ctrl_t *ctrl);
 
+/**
+ * @brief Set path to follow to the pose order
+ *
+ * In CTRL_MODE_RUNNING_PATH mode, the controller goes through path poses
+ * without stopping on them, then reaches the pose order as in
+ * CTRL_MODE_RUNNING mode. Applied by the control loop on its next turn, path
+ * tracking restarts from current pose if path changed.
+ *
+ * @param[in] ctrl              Controller object
+ * @param[in] poses             Poses to go through, pose order excluded
+ * @param[in] count             Number of poses, only the first
+ *                              CTRL_PATH_MAX_POSES ones are kept
+ *
+ * @return
+ */
+void ctrl_set_path_to_follow(ctrl_t* ctrl, const pose_t* poses, uint8_t count);
+
+/**
+ * @brief Get path to follow to the pose order
+ *
+ * @param[in] ctrl              Controller object
+ *
+ * @return                      Path to follow
+ */
+const ctrl_path_t* ctrl_get_path_to_follow(ctrl_t* ctrl);
+
 /**
  * @brief Set current pose
  *
+ * Applied by the control loop on its next turn, before odometry update.
+ *
  * @param[in] ctrl              Controller object
  * @param[in] pose_current      Current pose
  *
@@ -299,12 +534,30 @@ void ctrl_set_pose_current(ctrl_t* const ctrl, const pose_t* pose_current);
  */
 const pose_t* ctrl_get_pose_current(ctrl_t* ctrl);
 
+/**
+ * @brief Get pose at a given time, interpolated from pose history
+ *
+ * Used to compensate sensors latency: the pose is the one the robot had
+ * when the measure was done, not when it is processed.
+ *
+ * @param[in]  ctrl             Controller object
+ * @param[in]  timestamp        Time (us, xtimer_now_usec() clock)
+ * @param[out] pose             Pose at timestamp, closest pose recorded if
+ *                              timestamp is out of pose history
+ *
+ * @return                      0 on success
+ * @return                      not 0 if timestamp is older than pose history
+ */
+int ctrl_get_pose_at(ctrl_t* ctrl, uint32_t timestamp, pose_t* pose);
+
 /**
  * @brief Set speed order
  *
  * @param[in] ctrl              Controller object
  * @param[in] speed_order       Speed goal to reach pose order
  *
+ * Applied by the control loop on its next turn.
+ *
  * @note This set point can be overriden and ignored if user request a variable
  * speed_order. Please check @ref ctrl_register_speed_order_cb for more
  * informations.
@@ -370,6 +623,9 @@ const polar_t* ctrl_get_speed_current(ctrl_t* ctrl);
 /**
  * @brief Set current mode
  *
+ * Applied by the control loop on its next turn, or immediately when called
+ * from the control loop itself.
+ *
  * @param[in] ctrl              Controller object
  * @param[in] new_mode          New mode
  *
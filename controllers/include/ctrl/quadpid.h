@@ -18,6 +18,16 @@
  *   * Linear speed corrector:  Regulate linear speed to the pose order.
  *   * Angular speed corrector: Regulate rotation speed to the pose order.
  *
+ * Pose correctors do not regulate pose order directly: on each new pose order
+ * or regulation type, a jerk limited speed profile is planned to reach it, and
+ * pose correctors only correct the distance left behind that profile.
+ *
+ * In path tracking mode, the robot steers to a point a lookahead distance
+ * ahead on the path (pure pursuit), so it goes through path poses without
+ * stopping. Linear speed follows a speed profile planned on the remaining path
+ * length and is lowered in turns to keep rotation speed in speed order. Once
+ * pose order is about to be reached, it is reached as in running mode.
+ *
  * The structure ctrl_quadpid_t is used to represent the controller and inherit
  * from ctrl_t
  *   * linear_pose_pid:     Linear pose corrector
@@ -42,6 +52,7 @@
 /* Project includes */
 #include "ctrl.h"
 #include "odometry.h"
+#include "motion_profile.h"
 #include "pid.h"
 
 /**
@@ -53,6 +64,10 @@ typedef enum {
     CTRL_REGUL_POSE_ANGL,       /**< Final angle correction */
     CTRL_REGUL_POSE_PRE_ANGL,   /**< Pre-angle orientation to reach destination
                                      with straight trajectory */
+    CTRL_REGUL_PATH,            /**< Path tracking, through path poses without
+                                     stopping */
+    CTRL_REGUL_PATH_PRE_ANGL,   /**< Pre-angle orientation to start path
+                                     tracking */
 } ctrl_regul_t;
 
 /**
@@ -72,7 +87,27 @@ typedef struct {
                                                      switch to position reached
                                                      state */
 
+    uint16_t path_lookahead_distance;           /**< Distance ahead on path
+                                                     the robot steers to in
+                                                     path tracking */
+
     ctrl_regul_t regul;                     /**< Current regulation type */
+
+    motion_profile_t linear_profile;        /**< Linear speed profile */
+    motion_profile_t angular_profile;       /**< Angular speed profile */
+    pose_t profile_pose_order;              /**< Pose order profiles are
+                                                 planned for */
+    ctrl_regul_t profile_regul;             /**< Regulation type profiles are
+                                                 planned for */
+
+    pose_t path_start;                      /**< Pose path tracking started
+                                                 from */
+    uint8_t path_index;                     /**< Path pose the robot goes to,
+                                                 path count for pose order */
+    int8_t path_direction;                  /**< Path tracking direction, 1
+                                                 forward, -1 backward */
+    uint8_t path_speed_limited;             /**< Linear speed lowered in turn
+                                                 on previous cycle */
 } ctrl_quadpid_parameters_t;
 
 /**
@@ -155,6 +190,19 @@ int ctrl_quadpid_running_speed(ctrl_t* ctrl, polar_t* command);
  */
 int ctrl_quadpid_ingame(ctrl_t* ctrl, polar_t* command);
 
+/**
+ * @brief   QuadPID CTRL_MODE_RUNNING_PATH callback.
+ *
+ * Callback launched when controller is in path tracking mode
+ *
+ * @param[in]       ctrl        QuadPID controller object
+ * @param[out]   command        Linear and angular speed command
+ *
+ * @return                      0 on success
+ * @return                      not 0 on error
+ */
+int ctrl_quadpid_path(ctrl_t* ctrl, polar_t* command);
+
 
 /**
  * @brief    QuadPID controller static configuration.
@@ -166,6 +214,7 @@ static const ctrl_configuration_t ctrl_quadpid_conf = {
     .ctrl_mode_cb[CTRL_MODE_RUNNING] = ctrl_quadpid_ingame,
     .ctrl_mode_cb[CTRL_MODE_RUNNING_SPEED] = ctrl_quadpid_running_speed,
     .ctrl_mode_cb[CTRL_MODE_PASSTHROUGH] = ctrl_quadpid_nopid,
+    .ctrl_mode_cb[CTRL_MODE_RUNNING_PATH] = ctrl_quadpid_path,
 };
 
 /** @} */
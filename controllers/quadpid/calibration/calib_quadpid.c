@@ -52,9 +52,6 @@ typedef struct {
 } impulse_cfg_t;
 
 
-/* 20ms period == 50Hz sampling rate */
-#define PULSE_PER_SEC              50
-
 /* Shell command array */
 static shell_command_linked_t ctrl_quadpid_speed_shell_commands;
 static const char *quadpid_speed_name = "quadpid_speed";
@@ -114,23 +111,25 @@ static kernel_pid_t ctrl_quadpid_thread_command_pid = 0;
  *
  * @param[in]        cfg        Impulse function parameters, @ref impulse_cfg_t.
  * @param[in]       time        Time [cycle number].
+ * @param[in] cycles_per_sec    Control loop sampling rate [Hz].
  *
  * @return                      Computed set point
  */
-static double func_impulse(impulse_cfg_t* cfg, uint32_t time)
+static double func_impulse(impulse_cfg_t* cfg, uint32_t time,
+                           uint32_t cycles_per_sec)
 {
     double set_point = 0;
 
     if (cfg) {
         /* Timeline is before impulse start marker, motor set to 0 */
-        if (time < cfg->cycle_start_mot * PULSE_PER_SEC)
+        if (time < cfg->cycle_start_mot * cycles_per_sec)
             set_point = 0;
         /* Timeline is in impulse interval, motor set to impulse_max_value */
-        else if (time >= cfg->cycle_start_mot * PULSE_PER_SEC && time < cfg->cycle_end_mot * PULSE_PER_SEC)
+        else if (time >= cfg->cycle_start_mot * cycles_per_sec && time < cfg->cycle_end_mot * cycles_per_sec)
             set_point = cfg->impulse_max_value;
         /* Timeline is after impulse end marker, motor reset to 0 */
-        else if (time >= cfg->cycle_end_mot * PULSE_PER_SEC
-                && time < cfg->cycle_end_func * PULSE_PER_SEC)
+        else if (time >= cfg->cycle_end_mot * cycles_per_sec
+                && time < cfg->cycle_end_func * cycles_per_sec)
             set_point = 0;
         else
             seq_finished = TRUE;
@@ -154,7 +153,8 @@ static polar_t func_impulse_on_speed_order(ctrl_t* ctrl)
     polar_t speed_order = {0, 0};
 
     set_point = func_impulse(current_impulse_cfg,
-            ctrl_get_current_cycle(ctrl));
+            ctrl_get_current_cycle(ctrl),
+            US_PER_SEC / ctrl_get_period(ctrl));
 
     if (current_impulse_cfg->is_linear) {
         speed_order.distance = set_point;
@@ -49,21 +49,24 @@ static polar_t compute_position_error(const ctrl_quadpid_t* ctrl,
  * \param command : computed speed by position PID controller
  * \param final_speed : maximum speed
  * \param real_speed
+ * \param dt : time step, in CTRL_PERIOD_REFERENCE unit
  * \return speed_order
  */
 static double limit_speed_command(double command,
                                   double final_speed,
-                                  double real_speed)
+                                  double real_speed,
+                                  double dt)
 {
     /* limit speed command (maximum acceleration) */
     double a = command - real_speed;
+    double max_acc = MAX_ACC * dt;
 
-    if (a > MAX_ACC) {
-        command = real_speed + MAX_ACC;
+    if (a > max_acc) {
+        command = real_speed + max_acc;
     }
 
-    if (a < -MAX_ACC) {
-        command = real_speed - MAX_ACC;
+    if (a < -max_acc) {
+        command = real_speed - max_acc;
     }
 
     /* limit speed command (speed setpoint) */
@@ -78,6 +81,158 @@ static double limit_speed_command(double command,
     return command;
 }
 
+/**
+ * \fn plan_profiles
+ * \brief plan linear and angular speed profiles to reach pose order
+ * \param ctrl : QuadPID controller
+ * \param pos_err : distance and angle to run, 0 if not regulated
+ * \param speed_order : maximum speeds
+ * \param speed_start : start speeds, 0 if not regulated
+ */
+static void plan_profiles(ctrl_quadpid_t* ctrl, const polar_t* pos_err,
+                          const polar_t* speed_order,
+                          const polar_t* speed_start)
+{
+    motion_profile_plan(&ctrl->quadpid_params.linear_profile,
+                        pos_err->distance, speed_start->distance,
+                        speed_order->distance, MAX_ACC, MAX_JERK);
+    motion_profile_plan(&ctrl->quadpid_params.angular_profile,
+                        pos_err->angle, speed_start->angle,
+                        speed_order->angle, MAX_ACC, MAX_JERK);
+
+    ctrl->quadpid_params.profile_pose_order = *ctrl_get_pose_to_reach((ctrl_t*)ctrl);
+    ctrl->quadpid_params.profile_regul = ctrl->quadpid_params.regul;
+}
+
+/**
+ * \fn track_profile
+ * \brief compute speed command following speed profile
+ * \param profile : speed profile
+ * \param pid : pose PID controller
+ * \param error : distance or angle left to pose order
+ * \param dt : time step, in CTRL_PERIOD_REFERENCE unit
+ * \return profile speed, corrected with the distance left behind profile
+ */
+static double track_profile(motion_profile_t *profile, PID_t *pid,
+                            double error, double dt)
+{
+    double position, speed;
+
+    motion_profile_update(profile, dt, &position, &speed);
+
+    /* Distance profile still has to run */
+    double profile_error = profile->direction * profile->distance - position;
+
+    return speed + pid_ctrl(pid, error - profile_error, dt);
+}
+
+/**
+ * \fn path_distance
+ * \brief compute distance between 2 poses
+ * \param p1 : first pose
+ * \param p2 : second pose
+ * \return distance
+ */
+static double path_distance(const pose_t *p1, const pose_t *p2)
+{
+    double x = p2->x - p1->x;
+    double y = p2->y - p1->y;
+
+    return sqrt(square(x) + square(y));
+}
+
+/**
+ * \fn path_pose
+ * \brief get pose of path to follow
+ * \param ctrl : QuadPID controller
+ * \param index : path pose index, -1 for path tracking start pose, path count
+ *                for pose order
+ * \return path pose
+ */
+static const pose_t* path_pose(ctrl_quadpid_t* ctrl, int index)
+{
+    const ctrl_path_t* path = ctrl_get_path_to_follow((ctrl_t*)ctrl);
+
+    if (index < 0) {
+        return &ctrl->quadpid_params.path_start;
+    }
+
+    if (index < path->count) {
+        return &path->poses[index];
+    }
+
+    return ctrl_get_pose_to_reach((ctrl_t*)ctrl);
+}
+
+/**
+ * \fn compute_path_carrot
+ * \brief compute point to steer to on path, lookahead distance ahead of robot
+ * projection on path, pose order at most. Path poses the robot passed or is
+ * close enough to steer to next segment are skipped.
+ * \param ctrl : QuadPID controller
+ * \param pose_current : robot pose
+ * \param carrot : point to steer to
+ * \return path length left to pose order
+ */
+static double compute_path_carrot(ctrl_quadpid_t* ctrl,
+                                  const pose_t* pose_current, pose_t* carrot)
+{
+    ctrl_quadpid_parameters_t* params = &ctrl->quadpid_params;
+    const int count = ctrl_get_path_to_follow((ctrl_t*)ctrl)->count;
+    double lookahead = params->path_lookahead_distance;
+    const pose_t *a, *b;
+    double length, remaining, t;
+    int i;
+
+    /* robot projection on current segment, as a segment length ratio */
+    for (;;) {
+        a = path_pose(ctrl, params->path_index - 1);
+        b = path_pose(ctrl, params->path_index);
+        length = path_distance(a, b);
+
+        t = 1;
+        if (length > 0) {
+            t = ((pose_current->x - a->x) * (b->x - a->x)
+                 + (pose_current->y - a->y) * (b->y - a->y)) / square(length);
+            t = MIN(MAX(t, 0), 1);
+        }
+
+        if ((params->path_index >= count)
+            || ((t < 1) && (path_distance(pose_current, b) > lookahead))) {
+            break;
+        }
+
+        params->path_index++;
+    }
+
+    carrot->x = a->x + t * (b->x - a->x);
+    carrot->y = a->y + t * (b->y - a->y);
+    carrot->O = 0;
+
+    remaining = (1 - t) * length;
+    for (i = params->path_index + 1; i <= count; i++) {
+        remaining += path_distance(path_pose(ctrl, i - 1), path_pose(ctrl, i));
+    }
+
+    /* walk lookahead distance along path from robot projection */
+    for (i = params->path_index; i <= count; i++) {
+        b = path_pose(ctrl, i);
+        length = path_distance(carrot, b);
+
+        if (length > lookahead) {
+            carrot->x += lookahead * (b->x - carrot->x) / length;
+            carrot->y += lookahead * (b->y - carrot->y) / length;
+            break;
+        }
+
+        lookahead -= length;
+        carrot->x = b->x;
+        carrot->y = b->y;
+    }
+
+    return remaining;
+}
+
 /**
  *
  */
@@ -85,6 +240,11 @@ int ctrl_quadpid_speed(ctrl_quadpid_t* ctrl,
                          polar_t* command, const polar_t* speed_current)
 {
     polar_t speed_error;
+    double dt = ctrl_get_dt((ctrl_t*)ctrl);
+    /* Blocking time is given in reference periods */
+    uint32_t blocking_cycles_max = (uint32_t)ctrl->pf_conf->blocking_cycles_max
+                                   * CTRL_PERIOD_REFERENCE
+                                   / ctrl_get_period((ctrl_t*)ctrl);
 
     DEBUG("@robot@,%u,%"PRIu32",@speed_order@,%.2f,%.2f\n",
                 ROBOT_ID,
@@ -106,7 +266,7 @@ int ctrl_quadpid_speed(ctrl_quadpid_t* ctrl,
         ctrl->control.blocking_cycles = 0;
     }
 
-    if (ctrl->control.blocking_cycles >= ctrl->pf_conf->blocking_cycles_max) {
+    if (ctrl->control.blocking_cycles >= blocking_cycles_max) {
         command->distance = 0;
         command->angle = 0;
         ctrl_set_mode((ctrl_t*)ctrl, CTRL_MODE_BLOCKED);
@@ -116,9 +276,9 @@ int ctrl_quadpid_speed(ctrl_quadpid_t* ctrl,
     }
 
     command->distance = pid_ctrl(&ctrl->quadpid_params.linear_speed_pid,
-                                      speed_error.distance);
+                                      speed_error.distance, dt);
     command->angle = pid_ctrl(&ctrl->quadpid_params.angular_speed_pid,
-                                   speed_error.angle);
+                                   speed_error.angle, dt);
 
     return 0;
 }
@@ -164,6 +324,7 @@ int ctrl_quadpid_running_speed(ctrl_t* ctrl, polar_t* command)
     const polar_t* speed_current = ctrl_get_speed_current(ctrl);
     /* Get speed order */
     const polar_t* speed_order = ctrl_get_speed_order((ctrl_t*)ctrl);
+    double dt = ctrl_get_dt(ctrl);
 
     /* Compute speed order */
     ctrl_compute_speed_order((ctrl_t*)ctrl);
@@ -174,10 +335,12 @@ int ctrl_quadpid_running_speed(ctrl_t* ctrl, polar_t* command)
     /* limit speed command->*/
     command->distance = limit_speed_command(command->distance,
                                          fabs(speed_order->distance),
-                                         speed_current->distance);
+                                         speed_current->distance,
+                                         dt);
     command->angle = limit_speed_command(command->angle,
                                       fabs(speed_order->angle),
-                                      speed_current->angle);
+                                      speed_current->angle,
+                                      dt);
 
     /* ********************** speed pid controller ********************* */
     return ctrl_quadpid_speed((ctrl_quadpid_t*)ctrl, command, speed_current);
@@ -190,9 +353,13 @@ int ctrl_quadpid_ingame(ctrl_t* ctrl, polar_t* command)
 
     const pose_t* pose_current = ctrl_get_pose_current(ctrl);
     const polar_t* speed_current = ctrl_get_speed_current(ctrl);
+    double dt = ctrl_get_dt(ctrl);
 
     ctrl_quadpid_t* ctrl_quadpid = (ctrl_quadpid_t*)ctrl;
 
+    /* Pose reached on a previous cycle, robot only holds it */
+    uint8_t pose_reached = ctrl_quadpid->control.pose_reached;
+
     /* ******************** position pid ctrl ******************** */
 
     /* compute position error */
@@ -269,11 +436,38 @@ int ctrl_quadpid_ingame(ctrl_t* ctrl, polar_t* command)
         }
     }
 
-    /* compute speed command->with position pid controller */
-    command->distance = pid_ctrl(&ctrl_quadpid->quadpid_params.linear_pose_pid,
-                                      pos_err.distance);
-    command->angle = pid_ctrl(&ctrl_quadpid->quadpid_params.angular_pose_pid,
-                                   pos_err.angle);
+    /* plan speed profiles on new pose order, regulation type or mode.
+     * Heading is only corrected, not profiled, while running distance, and
+     * distance is not run while rotating. Once pose is reached, regulation
+     * type keeps switching while holding it, profiles are finished and only
+     * pose PIDs correct the robot. */
+    if ((ctrl->control.current_cycle == 0)
+        || (!pose_equal(pose_order, &ctrl_quadpid->quadpid_params.profile_pose_order))
+        || ((!pose_reached)
+            && (ctrl_quadpid->quadpid_params.regul != ctrl_quadpid->quadpid_params.profile_regul))) {
+        polar_t profile_err = { 0, 0 };
+        polar_t speed_start = { 0, 0 };
+
+        if (ctrl_quadpid->quadpid_params.regul == CTRL_REGUL_POSE_DIST) {
+            profile_err.distance = pos_err.distance;
+            speed_start.distance = speed_current->distance;
+        }
+        else {
+            profile_err.angle = pos_err.angle;
+            speed_start.angle = speed_current->angle;
+        }
+
+        plan_profiles(ctrl_quadpid, &profile_err, speed_order, &speed_start);
+    }
+
+    /* compute speed command->with position pid controller tracking speed
+     * profiles */
+    command->distance = track_profile(&ctrl_quadpid->quadpid_params.linear_profile,
+                                      &ctrl_quadpid->quadpid_params.linear_pose_pid,
+                                      pos_err.distance, dt);
+    command->angle = track_profile(&ctrl_quadpid->quadpid_params.angular_profile,
+                                   &ctrl_quadpid->quadpid_params.angular_pose_pid,
+                                   pos_err.angle, dt);
 
     DEBUG("@robot@,%u,%"PRIu32",@pose_set@,%.2f,%.2f\n",
                 ROBOT_ID,
@@ -281,13 +475,166 @@ int ctrl_quadpid_ingame(ctrl_t* ctrl, polar_t* command)
                 command->distance,
                 command->angle);
 
-    /* limit speed command->*/
-    command->distance = limit_speed_command(command->distance,
-                                         speed_order->distance,
-                                         speed_current->distance);
-    command->angle = limit_speed_command(command->angle,
-                                      speed_order->angle,
-                                      speed_current->angle);
+    /* limit speed command (speed setpoint), acceleration is limited by
+     * speed profiles */
+    command->distance = MIN(MAX(command->distance, -fabs(speed_order->distance)),
+                            fabs(speed_order->distance));
+    command->angle = MIN(MAX(command->angle, -fabs(speed_order->angle)),
+                         fabs(speed_order->angle));
+
+    /* ********************** speed pid controller ********************* */
+    return ctrl_quadpid_speed(ctrl_quadpid, command, speed_current);
+}
+
+int ctrl_quadpid_path(ctrl_t* ctrl, polar_t* command)
+{
+    const pose_t* pose_order = ctrl_get_pose_to_reach(ctrl);
+    const pose_t* pose_current = ctrl_get_pose_current(ctrl);
+    const polar_t* speed_current = ctrl_get_speed_current(ctrl);
+    const polar_t* speed_order = ctrl_get_speed_order(ctrl);
+    double dt = ctrl_get_dt(ctrl);
+
+    ctrl_quadpid_t* ctrl_quadpid = (ctrl_quadpid_t*)ctrl;
+    ctrl_quadpid_parameters_t* params = &ctrl_quadpid->quadpid_params;
+
+    pose_t carrot;
+    polar_t carrot_err;
+    double remaining, curvature, speed_max;
+    uint8_t path_index;
+
+    /* restart path tracking from current pose on new mode, path or pose
+     * order */
+    uint8_t restart = (ctrl->control.current_cycle == 0)
+                      || (!pose_equal(pose_order, &params->profile_pose_order));
+    uint8_t plan = restart;
+
+    if (restart) {
+        params->path_start = *pose_current;
+        params->path_index = 0;
+    }
+    else if ((params->regul != CTRL_REGUL_PATH)
+             && (params->regul != CTRL_REGUL_PATH_PRE_ANGL)) {
+        /* path end, pose order is reached as in running mode */
+        return ctrl_quadpid_ingame(ctrl, command);
+    }
+
+    path_index = params->path_index;
+    remaining = compute_path_carrot(ctrl_quadpid, pose_current, &carrot);
+    carrot_err = compute_position_error(ctrl_quadpid, &carrot, pose_current);
+
+    /* go backward if path starts behind robot and it is allowed */
+    if (restart) {
+        params->path_direction = 1;
+        params->regul = CTRL_REGUL_PATH;
+
+        if (ctrl->control.allow_reverse && (fabs(carrot_err.angle) > 90)) {
+            params->path_direction = -1;
+        }
+    }
+
+    if (params->path_direction < 0) {
+        carrot_err.angle = limit_angle_deg(carrot_err.angle + 180);
+    }
+
+    DEBUG("@robot@,%u,%"PRIu32",@path_carrot@,%.2f,%.2f,%.2f\n",
+                ROBOT_ID,
+                ctrl->control.current_cycle,
+                carrot.x,
+                carrot.y,
+                remaining);
+
+    /* robot heads to pose order on last segment: it is reached as in running
+     * mode, going straight to it. Same if robot missed it. */
+    if (params->path_index >= ctrl_get_path_to_follow(ctrl)->count) {
+        polar_t pos_err = compute_position_error(ctrl_quadpid, pose_order, pose_current);
+
+        if (params->path_direction < 0) {
+            pos_err.angle = limit_angle_deg(pos_err.angle + 180);
+        }
+
+        if ((fabs(pos_err.angle) <= params->min_angle_for_pose_reached)
+            || (pos_err.distance <= params->min_distance_for_angular_switch)
+            || (remaining <= 0)) {
+            params->regul = CTRL_REGUL_POSE_DIST;
+            return ctrl_quadpid_ingame(ctrl, command);
+        }
+    }
+
+    /* if path goes behind robot, it rotates on the spot */
+    if ((params->regul == CTRL_REGUL_PATH) && (fabs(carrot_err.angle) > 90)) {
+        polar_t profile_err = { 0, carrot_err.angle };
+        polar_t speed_start = { 0, speed_current->angle };
+
+        params->regul = CTRL_REGUL_PATH_PRE_ANGL;
+        plan_profiles(ctrl_quadpid, &profile_err, speed_order, &speed_start);
+    }
+
+    if (params->regul == CTRL_REGUL_PATH_PRE_ANGL) {
+        if ((!motion_profile_is_finished(&params->angular_profile))
+            && (fabs(carrot_err.angle) > params->min_angle_for_pose_reached)) {
+            pid_reset(&params->linear_pose_pid);
+            pid_reset(&params->linear_speed_pid);
+
+            command->distance = 0;
+            command->angle = track_profile(&params->angular_profile,
+                                           &params->angular_pose_pid,
+                                           carrot_err.angle, dt);
+            command->angle = MIN(MAX(command->angle, -fabs(speed_order->angle)),
+                                 fabs(speed_order->angle));
+
+            return ctrl_quadpid_speed(ctrl_quadpid, command, speed_current);
+        }
+
+        /* robot heads to path, start moving */
+        params->regul = CTRL_REGUL_PATH;
+        plan = TRUE;
+    }
+
+    /* pure pursuit: curvature of the arc going through carrot. Linear speed
+     * is lowered when robot does not head to carrot, and to keep rotation
+     * speed in speed order */
+    curvature = 0;
+    if (carrot_err.distance > 0) {
+        curvature = 2 * sin(DEG2RAD(carrot_err.angle)) / carrot_err.distance;
+    }
+
+    speed_max = fabs(speed_order->distance) * cos(DEG2RAD(carrot_err.angle));
+    if (fabs(curvature) > 0) {
+        speed_max = MIN(speed_max, DEG2RAD(fabs(speed_order->angle)) / fabs(curvature));
+    }
+
+    /* plan linear speed profile on path length left, again once a path pose
+     * is passed, or once turn does not limit speed anymore as robot lags
+     * behind profile */
+    if (plan || (params->path_index != path_index)
+        || (params->path_speed_limited
+            && ((speed_max >= fabs(speed_order->distance))
+                || (speed_max > fabs(speed_current->distance) + MAX_ACC * dt)))) {
+        polar_t profile_err = { params->path_direction * remaining, 0 };
+        polar_t speed_start = { speed_current->distance, 0 };
+
+        plan_profiles(ctrl_quadpid, &profile_err, speed_order, &speed_start);
+        pid_reset(&params->angular_pose_pid);
+        params->path_speed_limited = FALSE;
+    }
+
+    command->distance = track_profile(&params->linear_profile,
+                                      &params->linear_pose_pid,
+                                      params->path_direction * remaining, dt);
+
+    if ((speed_max < fabs(speed_order->distance))
+        && (fabs(command->distance) > speed_max)) {
+        params->path_speed_limited = TRUE;
+    }
+
+    command->distance = MIN(MAX(command->distance, -speed_max), speed_max);
+    command->angle = RAD2DEG(fabs(command->distance) * curvature);
+
+    DEBUG("@robot@,%u,%"PRIu32",@pose_set@,%.2f,%.2f\n",
+                ROBOT_ID,
+                ctrl->control.current_cycle,
+                command->distance,
+                command->angle);
 
     /* ********************** speed pid controller ********************* */
     return ctrl_quadpid_speed(ctrl_quadpid, command, speed_current);
@@ -65,6 +65,19 @@ void pca9548_init(void);
  */
 void pca9548_set_current_channel(pca9548_t dev, uint8_t channel);
 
+/**
+ * @brief Enable several channels at once
+ *
+ * Devices on enabled channels share the bus, so they must have distinct I2C
+ * addresses. Current channel is left unchanged.
+ *
+ * @param[in]   dev             PCA9548 device id
+ * @param[in]   channels        Bitmask of channels to enable
+ *
+ * @return
+ */
+void pca9548_set_channels(pca9548_t dev, uint8_t channels);
+
 /**
  * @brief Get current channel
  *
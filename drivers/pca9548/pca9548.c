@@ -5,26 +5,40 @@
 
 static uint8_t pca9548_current_channel[PCA9548_NUMOF];
 
-void pca9548_set_current_channel(pca9548_t dev, uint8_t channel)
+static int pca9548_write_channels(pca9548_t dev, uint8_t channels)
 {
-    assert(dev < PCA9548_NUMOF);
-
     const pca9548_conf_t *pca9548 = &pca9548_config[dev];
 
-    assert(channel < pca9548->channel_numof);
-
     i2c_acquire(pca9548->i2c_dev_id);
 
     int err = 1;
-    err = i2c_write_byte(pca9548->i2c_dev_id, pca9548->i2c_address, 1 << channel, 0);
+    err = i2c_write_byte(pca9548->i2c_dev_id, pca9548->i2c_address, channels, 0);
 
     i2c_release(pca9548->i2c_dev_id);
 
-    if (!err) {
+    return err;
+}
+
+void pca9548_set_current_channel(pca9548_t dev, uint8_t channel)
+{
+    assert(dev < PCA9548_NUMOF);
+
+    assert(channel < pca9548_config[dev].channel_numof);
+
+    if (!pca9548_write_channels(dev, 1 << channel)) {
         pca9548_current_channel[dev] = channel;
     }
 }
 
+void pca9548_set_channels(pca9548_t dev, uint8_t channels)
+{
+    assert(dev < PCA9548_NUMOF);
+
+    assert((channels >> pca9548_config[dev].channel_numof) == 0);
+
+    pca9548_write_channels(dev, channels);
+}
+
 uint8_t pca9548_get_current_channel(pca9548_t dev)
 {
     assert(dev < PCA9548_NUMOF);
@@ -20,8 +20,38 @@
 #include "vl53l0x.h"
 #include "xtimer.h"
 
+/* Ranging profile parameters */
+typedef struct {
+    FixPoint1616_t signal_rate_limit;   /* MCPS */
+    FixPoint1616_t sigma_limit;         /* mm */
+    uint32_t timing_budget;             /* us */
+} vl53l0x_profile_conf_t;
+
+static const vl53l0x_profile_conf_t profiles[VL53L0X_PROFILE_NUMOF] = {
+    [VL53L0X_PROFILE_DEFAULT] = {
+        .signal_rate_limit  = (FixPoint1616_t)(0.25 * 65536),
+        .sigma_limit        = (FixPoint1616_t)(18 * 65536),
+        .timing_budget      = 33000,
+    },
+    [VL53L0X_PROFILE_HIGH_SPEED] = {
+        .signal_rate_limit  = (FixPoint1616_t)(0.25 * 65536),
+        .sigma_limit        = (FixPoint1616_t)(32 * 65536),
+        .timing_budget      = 20000,
+    },
+    /* Objects are close when robot moves slowly, so signal is strong
+     * enough to reject noisy measures and average over a longer time */
+    [VL53L0X_PROFILE_HIGH_ACCURACY] = {
+        .signal_rate_limit  = (FixPoint1616_t)(0.3 * 65536),
+        .sigma_limit        = (FixPoint1616_t)(15 * 65536),
+        .timing_budget      = 50000,
+    },
+};
+
 static VL53L0X_Dev_t devices[VL53L0X_NUMOF];
 static VL53L0X_Error status[VL53L0X_NUMOF];
+static vl53l0x_profile_t current_profiles[VL53L0X_NUMOF];
+/* Profile applied once ranging is stopped, VL53L0X_PROFILE_NUMOF if none */
+static vl53l0x_profile_t pending_profiles[VL53L0X_NUMOF];
 
 int vl53l0x_init_dev(vl53l0x_t dev)
 {
@@ -86,11 +116,130 @@ int vl53l0x_init_dev(vl53l0x_t dev)
         Status = VL53L0X_StartMeasurement(st_api_vl53l0x);
     }
 
+    current_profiles[dev] = VL53L0X_PROFILE_DEFAULT;
+    pending_profiles[dev] = VL53L0X_PROFILE_NUMOF;
     status[dev] = Status;
 
     return Status;
 }
 
+int vl53l0x_set_profile(vl53l0x_t dev, vl53l0x_profile_t profile)
+{
+    VL53L0X_Error Status = VL53L0X_ERROR_NONE;
+    VL53L0X_Dev_t* st_api_vl53l0x = NULL;
+    const vl53l0x_profile_conf_t *conf = NULL;
+    uint32_t stop_pending = 1;
+
+    /* Check device and profile exist */
+    assert(dev < VL53L0X_NUMOF);
+    assert(profile < VL53L0X_PROFILE_NUMOF);
+
+    /* Device must be initialized */
+    if (status[dev] != VL53L0X_ERROR_NONE) {
+        return status[dev];
+    }
+
+    if ((current_profiles[dev] == profile)
+        && (pending_profiles[dev] == VL53L0X_PROFILE_NUMOF)) {
+        return Status;
+    }
+
+    st_api_vl53l0x = &devices[dev];
+    conf = &profiles[profile];
+
+    /* Timing budget can only be changed once ranging is stopped, which
+     * happens at the end of the measure in progress */
+    if (pending_profiles[dev] == VL53L0X_PROFILE_NUMOF) {
+        Status = VL53L0X_StopMeasurement(st_api_vl53l0x);
+    }
+    pending_profiles[dev] = profile;
+
+    if(Status == VL53L0X_ERROR_NONE)
+    {
+        Status = VL53L0X_GetStopCompletedStatus(st_api_vl53l0x, &stop_pending);
+    }
+
+    /* Do not wait, caller checks again later */
+    if ((Status == VL53L0X_ERROR_NONE) && stop_pending) {
+        return VL53L0X_PROFILE_SWITCHING;
+    }
+
+    pending_profiles[dev] = VL53L0X_PROFILE_NUMOF;
+
+    if(Status == VL53L0X_ERROR_NONE)
+    {
+        Status = VL53L0X_SetLimitCheckValue(st_api_vl53l0x,
+                VL53L0X_CHECKENABLE_SIGNAL_RATE_FINAL_RANGE,
+                conf->signal_rate_limit);
+    }
+
+    if(Status == VL53L0X_ERROR_NONE)
+    {
+        Status = VL53L0X_SetLimitCheckValue(st_api_vl53l0x,
+                VL53L0X_CHECKENABLE_SIGMA_FINAL_RANGE,
+                conf->sigma_limit);
+    }
+
+    if(Status == VL53L0X_ERROR_NONE)
+    {
+        Status = VL53L0X_SetMeasurementTimingBudgetMicroSeconds(st_api_vl53l0x,
+                conf->timing_budget);
+    }
+
+    if(Status == VL53L0X_ERROR_NONE)
+    {
+        Status = VL53L0X_StartMeasurement(st_api_vl53l0x);
+    }
+
+    if(Status == VL53L0X_ERROR_NONE)
+    {
+        current_profiles[dev] = profile;
+    }
+
+    status[dev] = Status;
+
+    return Status;
+}
+
+uint32_t vl53l0x_get_timing_budget(vl53l0x_t dev)
+{
+    /* Check device exists */
+    assert(dev < VL53L0X_NUMOF);
+
+    return profiles[current_profiles[dev]].timing_budget;
+}
+
+int vl53l0x_set_address(vl53l0x_t dev)
+{
+    VL53L0X_Error Status = VL53L0X_ERROR_NONE;
+    VL53L0X_Dev_t* st_api_vl53l0x = NULL;
+
+    /* Check device exists */
+    assert (dev < VL53L0X_NUMOF);
+
+    st_api_vl53l0x = &devices[dev];
+
+    /* Retrieve ToF */
+    const vl53l0x_conf_t* vl53l0x = &vl53l0x_config[dev];
+
+    st_api_vl53l0x->I2cDev          =  vl53l0x->i2c_dev;
+    st_api_vl53l0x->I2cDevAddr      =  VL53L0X_DEFAULT_ADDR;
+    st_api_vl53l0x->comms_type      =  1;
+
+    if (vl53l0x->i2c_addr == VL53L0X_DEFAULT_ADDR) {
+        return Status;
+    }
+
+    /* ST API expects an 8 bits address */
+    Status = VL53L0X_SetDeviceAddress(st_api_vl53l0x, vl53l0x->i2c_addr << 1);
+
+    if (Status == VL53L0X_ERROR_NONE) {
+        st_api_vl53l0x->I2cDevAddr = vl53l0x->i2c_addr;
+    }
+
+    return Status;
+}
+
 int vl53l0x_reset_dev(vl53l0x_t dev) {
     VL53L0X_Error Status = VL53L0X_ERROR_NONE;
     VL53L0X_Dev_t* st_api_vl53l0x = &devices[dev];
@@ -102,6 +251,11 @@ int vl53l0x_reset_dev(vl53l0x_t dev) {
 
     Status = VL53L0X_ResetDevice(st_api_vl53l0x);
 
+    /* Software reset restores default I2C address */
+    if (Status == VL53L0X_ERROR_NONE) {
+        st_api_vl53l0x->I2cDevAddr = VL53L0X_DEFAULT_ADDR;
+    }
+
     status[dev] = Status;
 
     return Status;
@@ -33,6 +33,16 @@
 #include "vl53l0x_platform.h"
 
 
+/**
+ * @brief   VL53L0X ToF sensor I2C address at power up
+ */
+#define VL53L0X_DEFAULT_ADDR    0x29
+
+/**
+ * @brief   Returned by @ref vl53l0x_set_profile while ranging is stopping
+ */
+#define VL53L0X_PROFILE_SWITCHING   1
+
 /**
  * @brief   VL53L0X ToF sensor id
  */
@@ -47,6 +57,17 @@ typedef struct {
 } vl53l0x_conf_t;
 
 
+/**
+ * @brief   VL53L0X ToF sensor ranging profiles
+ */
+typedef enum {
+    VL53L0X_PROFILE_DEFAULT = 0,    /**< ST API defaults, set by init */
+    VL53L0X_PROFILE_HIGH_SPEED,     /**< Short timing budget */
+    VL53L0X_PROFILE_HIGH_ACCURACY,  /**< Long timing budget, tight signal
+                                         rate and sigma limits */
+    VL53L0X_PROFILE_NUMOF,
+} vl53l0x_profile_t;
+
 /**
  * @brief Initialize given VL53L0X ToF sensor
  *
@@ -64,9 +85,25 @@ int vl53l0x_init_dev(vl53l0x_t dev);
  */
 void vl53l0x_init(void);
 
+/**
+ * @brief Move given VL53L0X ToF sensor from default I2C address to the one
+ *        in its configuration
+ *
+ * Sensors all answer on default address at power up or after a reset, so
+ * only this sensor must be reachable on the bus when called.
+ *
+ * param[in]    dev         VL53L0X ToF sensor id
+ *
+ * @return                  0 on success
+ * @return                  not 0 otherwise
+ */
+int vl53l0x_set_address(vl53l0x_t dev);
+
 /**
  * @brief Reset given VL53L0X ToF sensor
  *
+ * Sensor goes back to default I2C address.
+ *
  * param[in]    dev         VL53L0X ToF sensor id
  *
  * @return                  0 on success
@@ -81,6 +118,34 @@ int vl53l0x_reset_dev(vl53l0x_t dev);
  */
 void vl53l0x_reset(void);
 
+/**
+ * @brief Set ranging profile of given VL53L0X ToF sensor
+ *
+ * Continuous ranging is restarted if profile changes. It first has to stop
+ * at the end of the measure in progress, which is not waited for: call again
+ * until profile is applied.
+ *
+ * param[in]    dev         VL53L0X ToF sensor id
+ * param[in]    profile     Ranging profile
+ *
+ * @return                  0 on success
+ * @return                  VL53L0X_PROFILE_SWITCHING if ranging is still
+ *                          stopping
+ * @return                  negative value otherwise
+ */
+int vl53l0x_set_profile(vl53l0x_t dev, vl53l0x_profile_t profile);
+
+/**
+ * @brief Get timing budget of given VL53L0X ToF sensor current profile
+ *
+ * Last measure was ranged during this time, before it was read.
+ *
+ * @param[in]   dev         VL53L0X ToF sensor id
+ *
+ * @return                  timing budget (us)
+ */
+uint32_t vl53l0x_get_timing_budget(vl53l0x_t dev);
+
 /**
  * @brief Perform a continuous ranging measurement
  *
@@ -71,3 +71,14 @@ void *task_planner(void *arg);
  * @return
  */
 void pln_set_allow_change_path_pose(uint8_t value);
+
+/**
+ * @brief Set the time the planner can spend on graph update and path search
+ * on each period. Once exhausted, the update is suspended and resumed on next
+ * period, last valid path being followed meanwhile.
+ *
+ * @param[in] budget_us         Time budget in microseconds, 0 for no limit
+ *
+ * @return
+ */
+void pln_set_planning_budget(uint32_t budget_us);
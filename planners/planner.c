@@ -25,14 +25,32 @@ static uint8_t allow_change_path_pose = TRUE;
 /* Periodic task */
 #define TASK_PERIOD_MS      (50)
 
+/* Graph update and path search time budget per period */
+#define PLANNING_BUDGET_US  (TASK_PERIOD_MS * US_PER_MS / 2)
+static uint32_t planning_budget_us = PLANNING_BUDGET_US;
+
+/* Controller mode while game is running */
+#ifdef CTRL_PATH
+#define PLN_CTRL_MODE_RUNNING   CTRL_MODE_RUNNING_PATH
+#else
+#define PLN_CTRL_MODE_RUNNING   CTRL_MODE_RUNNING
+#endif
+
 void pln_set_allow_change_path_pose(uint8_t value)
 {
     allow_change_path_pose = value;
 }
 
+void pln_set_planning_budget(uint32_t budget_us)
+{
+    planning_budget_us = budget_us;
+}
+
 void pln_start(ctrl_t* ctrl)
 {
-    ctrl_set_mode(ctrl, CTRL_MODE_RUNNING);
+    /* Control loop jitter is measured during the game only */
+    ctrl_reset_timing(ctrl);
+    ctrl_set_mode(ctrl, PLN_CTRL_MODE_RUNNING);
     pln_started = TRUE;
 }
 
@@ -42,15 +60,112 @@ void pln_stop(ctrl_t* ctrl)
     pln_started = FALSE;
 }
 
+/* Index of the avoidance path pose given as pose order, the next ones up to
+ * CTRL_PATH_MAX_POSES are followed by controller without stopping */
+static int path_last_index(int index)
+{
+#ifdef CTRL_PATH
+    return MAX(index, MIN(index + CTRL_PATH_MAX_POSES,
+                          avoidance_get_path()->count - 1));
+#else
+    return index;
+#endif
+}
+
+/* When path pose to reach cannot be reached, next path poses are searched
+ * with a single graph update, spread over several periods like any other */
+static uint8_t fallback_pending = FALSE;
+/* Path poses given as goals to pending fallback update */
+static uint8_t fallback_goals_idx[AVOIDANCE_MAX_GOALS];
+static uint8_t fallback_nb_goals = 0;
+/* Next path pose to try and number of path poses left to try */
+static uint8_t fallback_next_idx = 0;
+static int fallback_control_loop = 0;
+
+/* Start searching path poses from current one */
+static void fallback_reset(path_t *path)
+{
+    fallback_next_idx = path_get_current_pose_idx(path);
+    fallback_control_loop = path->nb_pose;
+}
+
+/* Begin a graph update searching next path poses not tried yet. Path pose
+ * to reach is left unchanged until one is found.
+ * Return -1 if no path pose is left to try. */
+static int fallback_begin(const pose_t *robot_pose, path_t *path)
+{
+    uint8_t current_idx = path_get_current_pose_idx(path);
+    const path_pose_t *current_path_pos = NULL;
+    pose_t goals[AVOIDANCE_MAX_GOALS];
+    int res = -1;
+
+    path_set_current_pose_idx(path, fallback_next_idx);
+    current_path_pos = path_get_current_path_pos(path);
+
+    while ((res < 0) && (fallback_control_loop > 0)) {
+        fallback_nb_goals = 0;
+        while ((fallback_nb_goals < AVOIDANCE_MAX_GOALS) && (fallback_control_loop-- > 0)) {
+            path_increment_current_pose_idx(path);
+            if (current_path_pos == path_get_current_path_pos(path))
+                break;
+            current_path_pos = path_get_current_path_pos(path);
+            fallback_goals_idx[fallback_nb_goals] = path_get_current_pose_idx(path);
+            goals[fallback_nb_goals++] = current_path_pos->pos;
+        }
+        if (fallback_nb_goals == 0)
+            break;
+
+        /* Goals may all be inside obstacles, then go on with next ones */
+        res = avoidance_update_begin_goals(robot_pose, goals, fallback_nb_goals);
+    }
+
+    fallback_next_idx = path_get_current_pose_idx(path);
+
+    /* As before, path stays on last tried pose if none can be reached */
+    if (res == 0) {
+        path_set_current_pose_idx(path, current_idx);
+    }
+
+    return res;
+}
+
+/* Select first reachable pose in path order once fallback update is done.
+ * Return graph index, or AVOIDANCE_GRAPH_ERROR to go on with next path
+ * poses. */
+static int fallback_select(path_t *path, int graph_index)
+{
+    if (graph_index < 0) {
+        return AVOIDANCE_GRAPH_ERROR;
+    }
+
+    for (uint8_t i = 0; i < fallback_nb_goals; i++) {
+        if (avoidance_select_goal(i) == 0) {
+            path_set_current_pose_idx(path, fallback_goals_idx[i]);
+            return graph_index;
+        }
+    }
+
+    return AVOIDANCE_GRAPH_ERROR;
+}
+
 static int trajectory_get_route_update(ctrl_t* ctrl, const pose_t *robot_pose,
         pose_t *pose_to_reach, polar_t *speed_order, path_t *path)
 {
     const path_pose_t *current_path_pos = path_get_current_path_pos(path);
     static int index = 1;
-    int control_loop = 0;
     uint8_t need_update = 0;
+    uint8_t new_path = FALSE;
+
+    /* Obstacles are kept until pending graph update completes */
+    if (!avoidance_update_is_pending()) {
+        need_update = pf_read_sensors();
 
-    need_update = pf_read_sensors();
+        /* Obstacles changed, but path is updated only if they block it */
+        if (need_update && (!avoidance_is_path_blocked(robot_pose, index))) {
+            DEBUG("planner: Path not blocked, keep it\n");
+            need_update = 0;
+        }
+    }
 
     if (ctrl_is_pose_reached(ctrl)) {
         if ((pose_to_reach->x == current_path_pos->pos.x)
@@ -70,9 +185,9 @@ static int trajectory_get_route_update(ctrl_t* ctrl, const pose_t *robot_pose,
         else if ((!allow_change_path_pose) && (ctrl_is_pose_intermediate(ctrl))) {
             need_update = 1;
         }
-        else {
+        else if (index >= 0) {
             DEBUG("planner: Controller has reach intermediate position.\n");
-            index++;
+            index = path_last_index(index) + 1;
         }
     }
 
@@ -87,27 +202,78 @@ static int trajectory_get_route_update(ctrl_t* ctrl, const pose_t *robot_pose,
 
     if (need_update) {
         DEBUG("planner: Updating graph!\n");
-        index = update_graph(robot_pose, &(current_path_pos->pos));
+        fallback_pending = FALSE;
+        if (avoidance_update_begin(robot_pose, &(current_path_pos->pos)) < 0) {
+            index = AVOIDANCE_GRAPH_ERROR;
+            new_path = TRUE;
+            fallback_reset(path);
+        }
+    }
 
-        control_loop = path->nb_pose;
-        while ((index < 0) && (control_loop-- > 0)) {
-            if (index == -1) {
-                if (!allow_change_path_pose)
-                    goto trajectory_get_route_update_error;
-                path_increment_current_pose_idx(path);
-                if (current_path_pos == path_get_current_path_pos(path))
-                    goto trajectory_get_route_update_error;
-                current_path_pos = path_get_current_path_pos(path);
-                index = update_graph(robot_pose, &(current_path_pos->pos));
+    if (avoidance_update_is_pending()) {
+        int new_index = avoidance_update_resume(planning_budget_us);
+
+        if (new_index == AVOIDANCE_UPDATE_PENDING) {
+            DEBUG("planner: Graph update suspended, keep last path\n");
+        }
+        else if (new_index == AVOIDANCE_UPDATE_CANCELLED) {
+            DEBUG("planner: Graph update cancelled, begin it again\n");
+            fallback_pending = FALSE;
+            if (avoidance_update_begin(robot_pose, &(current_path_pos->pos)) < 0) {
+                index = AVOIDANCE_GRAPH_ERROR;
+                new_path = TRUE;
+                fallback_reset(path);
             }
         }
-        if (control_loop < 0) {
+        else if (fallback_pending) {
+            fallback_pending = FALSE;
+            index = fallback_select(path, new_index);
+            current_path_pos = path_get_current_path_pos(path);
+            new_path = TRUE;
+        }
+        else {
+            index = new_index;
+            new_path = TRUE;
+            /* Path pose valid but enclosed by obstacles, path found only
+             * holds start position */
+            if ((index >= 0)
+                && (avoidance_get_goal_distance(0) >= DIJKSTRA_MAX_DISTANCE)) {
+                DEBUG("planner: Path pose not reachable\n");
+                index = AVOIDANCE_GRAPH_ERROR;
+            }
+            if (index < 0) {
+                fallback_reset(path);
+            }
+        }
+    }
+
+    if (new_path && (index < 0)) {
+        if ((!allow_change_path_pose) || (fallback_begin(robot_pose, path) < 0)) {
             DEBUG("planner: No position reachable!\n");
             goto trajectory_get_route_update_error;
         }
+        DEBUG("planner: Searching next path poses\n");
+        fallback_pending = TRUE;
+    }
+
+    if (index < 0) {
+        /* Last pose to reach is kept until next path poses search is done */
+        if (fallback_pending) {
+            return 0;
+        }
+        goto trajectory_get_route_update_error;
     }
 
-    *pose_to_reach = avoidance(index);
+    *pose_to_reach = avoidance(path_last_index(index));
+#ifdef CTRL_PATH
+    if (index < avoidance_get_path()->count) {
+        ctrl_set_path_to_follow(ctrl, &avoidance_get_path()->poses[index],
+                                path_last_index(index) - index);
+    }
+    else {
+        ctrl_set_path_to_follow(ctrl, NULL, 0);
+    }
+#endif
     if ((pose_to_reach->x == current_path_pos->pos.x)
         && (pose_to_reach->y == current_path_pos->pos.y)) {
         pose_to_reach->O = current_path_pos->pos.O;
@@ -179,7 +345,7 @@ void *task_planner(void *arg)
             ctrl_set_mode(ctrl, CTRL_MODE_STOP);
         }
         else {
-            ctrl_set_mode(ctrl, CTRL_MODE_RUNNING);
+            ctrl_set_mode(ctrl, PLN_CTRL_MODE_RUNNING);
         }
 
         ctrl_set_speed_order(ctrl, &speed_order);
@@ -32,6 +32,7 @@
 #include "odometry.h"
 #include "path.h"
 #include "pca9548.h"
+#include "range_filter.h"
 #include "utils.h"
 #include "vl53l0x.h"
 
@@ -83,10 +84,16 @@
 
 /* Acceleration and speed profiles */
 #define MAX_ACC     5
+#define MAX_JERK    2.5
 #define MAX_SPEED   10
 #define LOW_SPEED           (MAX_SPEED / 4)
 #define NORMAL_SPEED        (MAX_SPEED / 2)
 
+/* Control loop period (us), from CTRL_PERIOD_MIN to CTRL_PERIOD_MAX.
+ * Speeds and accelerations are given per CTRL_PERIOD_REFERENCE whatever the
+ * period is. */
+#define PF_CTRL_PERIOD_US   CTRL_PERIOD_REFERENCE
+
 /* Anti-blocking */
 #define PF_CTRL_BLOCKING_SPEED_TRESHOLD         1
 #define PF_CTRL_BLOCKING_SPEED_ERR_TRESHOLD     1.5
@@ -104,15 +111,57 @@
 #define OBSTACLE_BORDER_Y_MAX   AVOIDANCE_BORDER_Y_MAX
 /* Obstacle size */
 #define OBSTACLE_DYN_SIZE                   400
+/* Maximum number of dynamic obstacles remembered */
+#define OBSTACLE_DYN_MAX                    8
+/* Dynamic obstacle is forgotten if not detected for this time */
+#define OBSTACLE_DYN_LIFETIME_MS            500
+/* Detections closer than this distance are the same obstacle */
+#define OBSTACLE_DYN_MATCH_DISTANCE         OBSTACLE_DYN_SIZE
+/* Known obstacle is moved only above this distance */
+#define OBSTACLE_DYN_MOVE_TOLERANCE         50
+/* Detections of a same sensors read closer than this distance are fused */
+#define OBSTACLE_DYN_CLUSTER_DISTANCE       OBSTACLE_DYN_SIZE
 /* Detection thresholds */
 #define OBSTACLE_DETECTION_MINIMUM_TRESHOLD 10
 #define OBSTACLE_DETECTION_MAXIMUM_TRESHOLD 200
+/* Detected obstacle is released further than detection threshold */
+#define OBSTACLE_DETECTION_HYSTERESIS       30
+/* Median window of sensors measures */
+#define OBSTACLE_DETECTION_FILTER_SIZE      3
+
+/* Sensors acquisition period, close to VL53L0X default timing budget */
+#define PF_SENSORS_PERIOD_MS    30
+/* Sensors acquisition period with high accuracy profile, longer than its
+ * timing budget. At low speed robot moves less than 10mm meanwhile. */
+#define PF_SENSORS_HIGH_ACCURACY_PERIOD_MS  55
+/* Sensors use high speed ranging profile above this speed (mm/cycle) and go
+ * back to high accuracy profile below the lower one. One sensor is switched
+ * per acquisition period, as each switch waits for the measure in progress
+ * to end. */
+#define PF_SENSORS_HIGH_SPEED_THRESHOLD     NORMAL_SPEED
+#define PF_SENSORS_HIGH_ACCURACY_THRESHOLD  LOW_SPEED
 
 typedef struct {
     double angle_offset;
     double distance_offset;
+    range_filter_conf_t filter;
 } pf_sensor_t;
 
+/* Sensor filtered measure, timestamped when read */
+typedef struct {
+    uint16_t distance;      /* mm, UINT16_MAX on error */
+    uint32_t timestamp;     /* us */
+    uint8_t detected;       /* obstacle detected */
+} pf_sensor_measure_t;
+
+/* Sensors measures filter */
+#define PF_SENSOR_FILTER_DEFAULT {                          \
+        .size = OBSTACLE_DETECTION_FILTER_SIZE,             \
+        .min = OBSTACLE_DETECTION_MINIMUM_TRESHOLD,         \
+        .max = OBSTACLE_DETECTION_MAXIMUM_TRESHOLD,         \
+        .hysteresis = OBSTACLE_DETECTION_HYSTERESIS,        \
+    }
+
 typedef struct {
     uint8_t nb_puck_front_ramp;
     uint8_t nb_puck_back_ramp;
@@ -129,32 +178,34 @@ typedef struct {
 
 /*
  * VL53L0X I2C configuration.
- * Identical for all as a PCA9548 I2C switch is used.
+ * Sensors are all on default address at power up, each one is moved to its
+ * own address at boot while it is alone on its PCA9548 I2C switch channel.
+ * Then all channels are enabled at once.
  */
 static const vl53l0x_conf_t vl53l0x_config[] = {
     {
         .i2c_dev    = 1,
-        .i2c_addr   = 0x29,
+        .i2c_addr   = 0x30,
     },
     {
         .i2c_dev    = 1,
-        .i2c_addr   = 0x29,
+        .i2c_addr   = 0x31,
     },
     {
         .i2c_dev    = 1,
-        .i2c_addr   = 0x29,
+        .i2c_addr   = 0x32,
     },
     {
         .i2c_dev    = 1,
-        .i2c_addr   = 0x29,
+        .i2c_addr   = 0x33,
     },
     {
         .i2c_dev    = 1,
-        .i2c_addr   = 0x29,
+        .i2c_addr   = 0x34,
     },
     {
         .i2c_dev    = 1,
-        .i2c_addr   = 0x29,
+        .i2c_addr   = 0x35,
     },
 };
 
@@ -193,26 +244,32 @@ static const pf_sensor_t pf_sensors[VL53L0X_NUMOF] = {
     {
         .angle_offset = 135,
         .distance_offset = ROBOT_MARGIN,
+        .filter = PF_SENSOR_FILTER_DEFAULT,
     },
     {
         .angle_offset = 180,
         .distance_offset = ROBOT_MARGIN,
+        .filter = PF_SENSOR_FILTER_DEFAULT,
     },
     {
         .angle_offset = -135,
         .distance_offset = ROBOT_MARGIN,
+        .filter = PF_SENSOR_FILTER_DEFAULT,
     },
     {
         .angle_offset = -45,
         .distance_offset = ROBOT_MARGIN,
+        .filter = PF_SENSOR_FILTER_DEFAULT,
     },
     {
         .angle_offset = 0,
         .distance_offset = ROBOT_MARGIN,
+        .filter = PF_SENSOR_FILTER_DEFAULT,
     },
     {
         .angle_offset = 45,
         .distance_offset = ROBOT_MARGIN,
+        .filter = PF_SENSOR_FILTER_DEFAULT,
     },
 };
 
@@ -244,6 +301,7 @@ extern shell_command_t cmd_exit_shell;
 extern shell_command_t cmd_print_state;
 extern shell_command_t cmd_print_dyn_obstacles;
 extern shell_command_t cmd_set_shm_key;
+extern shell_command_t cmd_set_ctrl_period;
 
 path_t *pf_get_path(void);
 int pf_is_game_launched(void);
@@ -260,18 +318,23 @@ void pf_init(void);
 int encoder_read(polar_t *robot_speed);
 void encoder_reset(void);
 int pf_read_sensors(void);
+uint32_t pf_get_sensors_measures(pf_sensor_measure_t *measures);
 void pf_calib_read_sensors(pca9548_t dev);
+void pf_vl53l0x_reset(void);
+void pf_vl53l0x_init(void);
 void motor_drive(polar_t *command);
 
 static const ctrl_platform_configuration_t ctrl_pf_quadpid_conf = {
     .ctrl_pre_mode_cb[CTRL_MODE_RUNNING]        = pf_ctrl_pre_running_cb,
     .ctrl_pre_mode_cb[CTRL_MODE_RUNNING_SPEED]  = pf_ctrl_pre_running_cb,
+    .ctrl_pre_mode_cb[CTRL_MODE_RUNNING_PATH]   = pf_ctrl_pre_running_cb,
     .ctrl_pre_mode_cb[CTRL_MODE_STOP]           = pf_ctrl_pre_running_cb,
     .ctrl_pre_mode_cb[CTRL_MODE_BLOCKED]        = pf_ctrl_pre_running_cb,
     .ctrl_post_mode_cb[CTRL_MODE_STOP]          = pf_ctrl_post_stop_cb,
     .ctrl_post_mode_cb[CTRL_MODE_BLOCKED]       = pf_ctrl_post_stop_cb,
     .ctrl_post_mode_cb[CTRL_MODE_RUNNING]       = pf_ctrl_post_running_cb,
     .ctrl_post_mode_cb[CTRL_MODE_RUNNING_SPEED] = pf_ctrl_post_running_cb,
+    .ctrl_post_mode_cb[CTRL_MODE_RUNNING_PATH]  = pf_ctrl_post_running_cb,
 
     .ctrl_pre_mode_cb[CTRL_MODE_PASSTHROUGH]   = pf_ctrl_pre_running_cb,
     .ctrl_post_mode_cb[CTRL_MODE_PASSTHROUGH]  = pf_ctrl_post_running_cb,
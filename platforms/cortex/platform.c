@@ -1,5 +1,7 @@
 /* System includes */
 #include <thread.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -7,6 +9,7 @@
 #define ENABLE_DEBUG        (0)
 #include "debug.h"
 #include "log.h"
+#include "mutex.h"
 #include "shell.h"
 #include "xtimer.h"
 
@@ -27,12 +30,14 @@ static ctrl_quadpid_t ctrl_quadpid =
 {
     .conf = &ctrl_quadpid_conf,
     .pf_conf = &ctrl_pf_quadpid_conf,
+    .control.period = PF_CTRL_PERIOD_US,
 };
 
 /* Thread stacks */
 char controller_thread_stack[THREAD_STACKSIZE_LARGE];
 char countdown_thread_stack[THREAD_STACKSIZE_DEFAULT];
 char planner_thread_stack[THREAD_STACKSIZE_LARGE];
+char sensors_thread_stack[THREAD_STACKSIZE_LARGE];
 char start_shell_thread_stack[THREAD_STACKSIZE_LARGE];
 
 /* Shell command array */
@@ -44,6 +49,27 @@ static const char *pf_name = "platform";
 /* Shared memory key used to communicate with the simulator */
 int pf_shm_key = 0;
 
+/* Sensors measures double buffer: acquisition thread fills one buffer while
+ * the other one, published, can be copied by the planner */
+static pf_sensor_measure_t sensors_measures[2][VL53L0X_NUMOF];
+/* Published buffer index */
+static atomic_uint sensors_published = ATOMIC_VAR_INIT(0);
+/* Number of sensors sweeps published */
+static atomic_uint sensors_sequence = ATOMIC_VAR_INIT(0);
+/* Sensors measures filters, only used by acquisition thread */
+static range_filter_t sensors_filters[VL53L0X_NUMOF];
+/* VL53L0X sensors and their I2C switch are shared by acquisition thread,
+ * planner actions (reset and init) and calibration shell. Measures are given
+ * to the planner through the double buffer above, without lock. */
+static mutex_t sensors_lock = MUTEX_INIT;
+/* Sensors are on their own address and can be read */
+static uint8_t sensors_ready = FALSE;
+/* Filters hold measures from before last sensors reset, they are reset by
+ * acquisition thread before next read */
+static uint8_t sensors_filters_stale = FALSE;
+/* Sensors ranging profiles, back to default on init */
+static vl53l0x_profile_t sensors_profiles[VL53L0X_NUMOF];
+
 void pf_push_shell_commands(shell_command_linked_t *shell_commands) {
     shell_commands->previous = current_shell_commands.current;
     memcpy(&current_shell_commands, shell_commands, sizeof(shell_command_linked_t));
@@ -143,6 +169,14 @@ int pf_print_state(int argc, char **argv)
           "{"
             "\"distance\": \"%lf\", "
             "\"angle\": \"%lf\""
+          "}, "
+          "\"timing\": "
+          "{"
+            "\"period\": \"%"PRIu32"\", "
+            "\"exec_time\": \"%"PRIu32"\", "
+            "\"period_min\": \"%"PRIu32"\", "
+            "\"period_max\": \"%"PRIu32"\", "
+            "\"exec_time_max\": \"%"PRIu32"\""
           "}"
         "}\n",
         ctrl_quadpid.control.current_mode,
@@ -156,7 +190,12 @@ int pf_print_state(int argc, char **argv)
         ctrl_quadpid.control.speed_current.distance,
         ctrl_quadpid.control.speed_current.angle,
         ctrl_quadpid.control.speed_order.distance,
-        ctrl_quadpid.control.speed_order.angle
+        ctrl_quadpid.control.speed_order.angle,
+        ctrl_quadpid.control.timing.period,
+        ctrl_quadpid.control.timing.exec_time,
+        ctrl_quadpid.control.timing.period_min,
+        ctrl_quadpid.control.timing.period_max,
+        ctrl_quadpid.control.timing.exec_time_max
     );
 
     return EXIT_SUCCESS;
@@ -175,6 +214,27 @@ int pf_set_shm_key(int argc, char **argv)
     return EXIT_SUCCESS;
 }
 
+int pf_set_ctrl_period(int argc, char **argv)
+{
+    ctrl_t *ctrl = pf_get_ctrl();
+
+    /* Check arguments */
+    if (argc > 2) {
+        puts("Bad number of arguments!");
+        return EXIT_FAILURE;
+    }
+
+    if ((argc == 2) && (ctrl_set_period(ctrl, atoi(argv[1])) != 0)) {
+        printf("Period must be between %u and %u us\n",
+               CTRL_PERIOD_MIN, CTRL_PERIOD_MAX);
+        return EXIT_FAILURE;
+    }
+
+    printf("Control loop period: %"PRIu32" us\n", ctrl_get_period(ctrl));
+
+    return EXIT_SUCCESS;
+}
+
 shell_command_t cmd_exit_shell = {
     "exit", "Exit planner calibration",
     pf_exit_shell
@@ -200,6 +260,11 @@ shell_command_t cmd_set_shm_key = {
     pf_set_shm_key
 };
 
+shell_command_t cmd_set_ctrl_period = {
+    "ctrl_period", "Get or set control loop period (us)",
+    pf_set_ctrl_period
+};
+
 
 void pf_init_quadpid_params(ctrl_quadpid_parameters_t ctrl_quadpid_params)
 {
@@ -225,13 +290,18 @@ void pf_ctrl_pre_running_cb(pose_t *robot_pose, polar_t* robot_speed, polar_t *m
 {
     (void)motor_command;
 
+    ctrl_t *ctrl = pf_get_ctrl();
+
     /* catch speed */
     encoder_read(robot_speed);
 
     /* convert to position */
     odometry_update(robot_pose, robot_speed, SEGMENT);
 
-    ctrl_t *ctrl = pf_get_ctrl();
+    /* Encoders give distance since previous loop turn, controllers expect
+     * it per reference period whatever the loop period is */
+    robot_speed->distance /= ctrl_get_dt(ctrl);
+    robot_speed->angle /= ctrl_get_dt(ctrl);
 
     if (ctrl_get_mode(ctrl) != CTRL_MODE_STOP)
         DEBUG("@robot@,%u,%"PRIu32",@pose_current@,%.2f,%.2f,%.2f\n",
@@ -325,82 +395,144 @@ int pf_is_game_launched(void)
     return !gpio_read(GPIO_STARTER);
 }
 
+/* Reset all sensors, they all go back to default address so
+ * pf_vl53l0x_init() has to be called after */
 void pf_vl53l0x_reset(void)
 {
+    mutex_lock(&sensors_lock);
+
+    /* Acquisition is suspended until sensors are initialized again */
+    sensors_ready = FALSE;
+    sensors_filters_stale = TRUE;
+
     for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
         pca9548_set_current_channel(PCA9548_SENSORS, vl53l0x_channel[dev]);
         if (vl53l0x_reset_dev(dev) != 0)
             DEBUG("ERROR: Sensor %u reset failed !!!\n", dev);
     }
+
+    mutex_unlock(&sensors_lock);
 }
 
+/* Give each sensor its own address, then enable all sensors channels so
+ * they can be read without switching channel */
 void pf_vl53l0x_init(void)
 {
+    uint8_t channels = 0;
+
+    mutex_lock(&sensors_lock);
+
     for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
+        /* Sensor is alone on the bus */
         pca9548_set_current_channel(PCA9548_SENSORS, vl53l0x_channel[dev]);
+        /* Sensor may already be on its address if it was not powered off */
+        if (vl53l0x_set_address(dev) != 0)
+            DEBUG("Sensor %u not on default address\n", dev);
         if (vl53l0x_init_dev(dev) != 0)
-            DEBUG("ERROR: Sensor %u init failed !!!\n", dev);
+            printf("ERROR: Sensor %u init failed !!!\n", dev);
+        sensors_profiles[dev] = VL53L0X_PROFILE_DEFAULT;
+        channels |= 1 << vl53l0x_channel[dev];
     }
+
+    pca9548_set_channels(PCA9548_SENSORS, channels);
+
+    /* First measures after init are not filtered with previous ones */
+    sensors_ready = TRUE;
+    sensors_filters_stale = TRUE;
+
+    mutex_unlock(&sensors_lock);
+}
+
+/* Copy last published sensors sweep, return its sequence number, 0 if none
+ * has been published yet */
+uint32_t pf_get_sensors_measures(pf_sensor_measure_t *measures)
+{
+    uint32_t sequence;
+
+    /* Copy again if a new sweep was published meanwhile, as acquisition
+     * thread may then be filling the copied buffer */
+    do {
+        sequence = atomic_load_explicit(&sensors_sequence, memory_order_acquire);
+        memcpy(measures,
+               sensors_measures[atomic_load_explicit(&sensors_published, memory_order_acquire)],
+               sizeof(sensors_measures[0]));
+    } while (sequence != atomic_load_explicit(&sensors_sequence, memory_order_acquire));
+
+    return sequence;
 }
 
 int pf_read_sensors(void)
 {
-    int obstacle_found = 0;
+    static uint32_t sequence_read = 0;
+    pf_sensor_measure_t measures[VL53L0X_NUMOF];
+    uint32_t sequence;
     int res = 0;
 
     ctrl_t* ctrl = (ctrl_t*)pf_get_quadpid_ctrl();
 
-    reset_dyn_polygons();
-
     if (((ctrl_quadpid_t *)ctrl)->quadpid_params.regul == CTRL_REGUL_POSE_PRE_ANGL) {
-        return 0;
+        goto pf_read_sensors_update;
     }
 
-    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
-
-        uint16_t measure;
-        irq_disable();
+    /* Each sensors sweep is used only once */
+    sequence = pf_get_sensors_measures(measures);
+    if (sequence == sequence_read) {
+        goto pf_read_sensors_update;
+    }
+    sequence_read = sequence;
 
-        pca9548_set_current_channel(PCA9548_SENSORS, vl53l0x_channel[dev]);
-        measure = vl53l0x_continuous_ranging_get_measure(dev);
+    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
+        uint16_t measure = measures[dev].distance;
 
-        irq_enable();
         DEBUG("Measure sensor %u: %u\n\n", dev, measure);
 
-        if ((measure > OBSTACLE_DETECTION_MINIMUM_TRESHOLD)
-                && (measure < OBSTACLE_DETECTION_MAXIMUM_TRESHOLD)) {
+        if (measures[dev].detected) {
             const pf_sensor_t* sensor = &pf_sensors[dev];
-            pose_t robot_pose = *ctrl_get_pose_current(ctrl);
+            pose_t robot_pose;
+
+            /* Obstacle is projected from the pose the robot had when the
+             * measure was done */
+            if (ctrl_get_pose_at(ctrl, measures[dev].timestamp, &robot_pose)) {
+                LOG_WARNING("Sensor %u measure older than pose history\n", dev);
+            }
 
             res = add_dyn_obstacle(dev, &robot_pose, sensor->angle_offset, sensor->distance_offset, (double)measure);
 
-            if (!res) {
-                obstacle_found = 1;
+            if (res) {
+                DEBUG("Obstacle ignored for sensor %u\n", dev);
             }
         }
 
     }
 
-    return obstacle_found;
+pf_read_sensors_update:
+    /* Obstacles are only given to avoidance when they changed */
+    return update_dyn_obstacles();
 }
 
 void pf_calib_read_sensors(pca9548_t dev)
 {
     vl53l0x_t sensor = 0;
-    uint8_t channel = pca9548_get_current_channel(dev);
+    uint8_t channel;
+
+    mutex_lock(&sensors_lock);
+
+    channel = pca9548_get_current_channel(dev);
     for (sensor = 0; sensor < VL53L0X_NUMOF; sensor++) {
         if (vl53l0x_channel[sensor] == channel)
             break;
     }
 
     if (sensor < VL53L0X_NUMOF) {
-        uint16_t measure = vl53l0x_continuous_ranging_get_measure(dev);
+        uint16_t measure = vl53l0x_continuous_ranging_get_measure(sensor);
 
         printf("Measure sensor %u: %u\n\n", sensor, measure);
     }
     else {
         printf("No sensor for this channel %u !\n\n", sensor);
     }
+
+    mutex_unlock(&sensors_lock);
 }
 
 
@@ -411,6 +543,142 @@ int pf_is_camp_left(void)
 }
 
 
+/* Select sensors ranging profile from robot speed: short timing budget for
+ * fast updates when driving fast, accurate measures when moving slowly */
+static vl53l0x_profile_t pf_select_sensors_profile(vl53l0x_profile_t profile)
+{
+    double speed = fabs(ctrl_get_speed_current(pf_get_ctrl())->distance);
+
+    if (speed > PF_SENSORS_HIGH_SPEED_THRESHOLD) {
+        return VL53L0X_PROFILE_HIGH_SPEED;
+    }
+    if ((speed < PF_SENSORS_HIGH_ACCURACY_THRESHOLD)
+        || (profile == VL53L0X_PROFILE_DEFAULT)) {
+        return VL53L0X_PROFILE_HIGH_ACCURACY;
+    }
+
+    return profile;
+}
+
+/* Reset filters if sensors were reset, switch one sensor at a time to
+ * profile, and give acquisition period. Return -1 if sensors are reset. */
+static int pf_switch_sensors_profile(vl53l0x_profile_t profile, uint32_t *period_ms)
+{
+    int res = -1;
+
+    mutex_lock(&sensors_lock);
+
+    if (!sensors_ready) {
+        goto pf_switch_sensors_profile_end;
+    }
+
+    if (sensors_filters_stale) {
+        for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
+            range_filter_reset(&sensors_filters[dev]);
+        }
+        sensors_filters_stale = FALSE;
+    }
+
+    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
+        if (sensors_profiles[dev] == profile)
+            continue;
+        /* Switch does not wait for ranging to stop, next sensor is switched
+         * once this one is done */
+        res = vl53l0x_set_profile(dev, profile);
+        if (res == VL53L0X_PROFILE_SWITCHING)
+            break;
+        if (res != 0)
+            DEBUG("ERROR: Sensor %u profile %u failed !!!\n", dev, profile);
+        sensors_profiles[dev] = profile;
+        break;
+    }
+
+    /* Period fits the longest timing budget in use */
+    *period_ms = PF_SENSORS_PERIOD_MS;
+    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
+        if (sensors_profiles[dev] == VL53L0X_PROFILE_HIGH_ACCURACY)
+            *period_ms = PF_SENSORS_HIGH_ACCURACY_PERIOD_MS;
+    }
+
+    res = 0;
+
+pf_switch_sensors_profile_end:
+    mutex_unlock(&sensors_lock);
+
+    return res;
+}
+
+/* Read last measure of a sensor. Return -1 if sensors are reset, or were
+ * reset since filters were. */
+static int pf_read_sensor(vl53l0x_t dev, range_sample_t *sample)
+{
+    int res = -1;
+
+    mutex_lock(&sensors_lock);
+
+    if (sensors_ready && !sensors_filters_stale) {
+        /* Last measure ranged during the timing budget before it was
+         * read, on average */
+        sample->distance = vl53l0x_continuous_ranging_get_measure(dev);
+        sample->timestamp = xtimer_now_usec() - vl53l0x_get_timing_budget(dev);
+        res = 0;
+    }
+
+    mutex_unlock(&sensors_lock);
+
+    return res;
+}
+
+/* Read all sensors periodically and publish their measures. Sensors are
+ * locked one access at a time, so reset and calibration only wait for a
+ * single I2C transaction. */
+static void *pf_task_sensors(void *arg)
+{
+    vl53l0x_profile_t profile = VL53L0X_PROFILE_DEFAULT;
+    uint32_t period_ms = PF_SENSORS_PERIOD_MS;
+
+    (void)arg;
+
+    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
+        range_filter_setup(&sensors_filters[dev], &pf_sensors[dev].filter);
+    }
+
+    for (;;) {
+        xtimer_ticks32_t loop_start_time = xtimer_now();
+        unsigned int back = !atomic_load_explicit(&sensors_published, memory_order_relaxed);
+
+        /* Nothing is published while sensors are reset */
+        profile = pf_select_sensors_profile(profile);
+        if (pf_switch_sensors_profile(profile, &period_ms)) {
+            goto pf_task_sensors_yield;
+        }
+
+        /* Sensors have their own address, no channel switching needed */
+        for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
+            pf_sensor_measure_t *measure = &sensors_measures[back][dev];
+            range_sample_t sample;
+            range_sample_t filtered;
+
+            if (pf_read_sensor(dev, &sample)) {
+                goto pf_task_sensors_yield;
+            }
+
+            /* Single spurious measures are rejected by median filter */
+            measure->detected = range_filter_update(&sensors_filters[dev], &sample, &filtered);
+            measure->distance = filtered.distance;
+            measure->timestamp = filtered.timestamp;
+        }
+
+        atomic_store_explicit(&sensors_published, back, memory_order_release);
+        atomic_fetch_add_explicit(&sensors_sequence, 1, memory_order_release);
+
+pf_task_sensors_yield:
+        xtimer_periodic_wakeup(&loop_start_time, period_ms * US_PER_MS);
+    }
+
+    return NULL;
+}
+
 static void *pf_task_countdown(void *arg)
 {
     (void)arg;
@@ -514,6 +782,15 @@ void pf_init_tasks(void)
         }
 #endif  /* CALIBRATION */
 
+        /* Create sensors acquisition thread, with lower priority than
+         * planner, only needed in game */
+        thread_create(sensors_thread_stack,
+                      sizeof(sensors_thread_stack),
+                      THREAD_PRIORITY_MAIN - 1, 0,
+                      pf_task_sensors,
+                      NULL,
+                      "sensors");
+
         /* Wait for start switch */
         while(!pf_is_game_launched());
 
@@ -537,6 +814,7 @@ void pf_init_tasks(void)
 void pf_init(void)
 {
     pf_init_shell_commands(&pf_shell_commands, pf_name);
+    pf_add_shell_command(&pf_shell_commands, &cmd_set_ctrl_period);
 
     motor_driver_init(MOTOR_DRIVER_DEV(0));
 
@@ -570,11 +848,7 @@ void pf_init(void)
 
     pca9548_init();
 
-    for (vl53l0x_t dev = 0; dev < VL53L0X_NUMOF; dev++) {
-        pca9548_set_current_channel(PCA9548_SENSORS, vl53l0x_channel[dev]);
-        if (vl53l0x_init_dev(dev) != 0)
-            printf("ERROR: Sensor %u init failed !!!\n", dev);
-    }
+    pf_vl53l0x_init();
 
     ctrl_set_anti_blocking_on(pf_get_ctrl(), TRUE);
 
@@ -1,61 +1,282 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "avoidance.h"
 #include "obstacle.h"
 #include "utils.h"
+#include "xtimer.h"
 
-/* Obstacle list. Each obstacle is a polygon */
+/* Obstacles pool. Each obstacle is a polygon, dynamic ones are referenced by
+ * their pool index as handle */
 static polygon_t polygons[POLY_MAX];
+/* Live obstacles as pool indexes, fixed polygons first then dynamic ones */
+static uint8_t live_polygons[POLY_MAX];
+/* Position of each pool entry in live_polygons */
+static uint8_t live_positions[POLY_MAX];
 /* Number of polygons */
 static int nb_polygons = 0;
 /* Number of dynamic polygons */
 static int nb_dyn_polygons = 0;
+/* Released pool entries, linked through free_polygons_next, and number of
+ * pool entries used at least once */
+static int8_t free_polygons_head = -1;
+static int8_t free_polygons_next[POLY_MAX];
+static uint8_t nb_pool_polygons = 0;
 
 /* List of visible points */
 static pose_t valid_points[MAX_POINTS];
 static uint8_t valid_points_count = 0;
+#ifdef AVOIDANCE_REDUCED_GRAPH
+/* Polygon and vertex index each point comes from, -1 for start and goals */
+static int8_t valid_points_polygon[MAX_POINTS];
+static int8_t valid_points_vertex[MAX_POINTS];
+#endif
 
-static uint64_t graph[GRAPH_MAX_VERTICES];
+/* Adjacency matrix, each row is a multi-word bitset of neighbours */
+static graph_bitset_t graph[GRAPH_MAX_VERTICES];
+
+/* Edges weights (distance in mm between two vertices).
+ * Dense lower triangular matrix filled while building the graph, so the path
+ * search does not have to compute any square root. */
+#define GRAPH_WEIGHTS_SIZE  ((GRAPH_MAX_VERTICES * (GRAPH_MAX_VERTICES - 1)) / 2)
+static uint16_t weights[GRAPH_WEIGHTS_SIZE];
+
+/* Fixed polygons part of the graph.
+ * Valid points of fixed polygons are stored in valid_points just after start
+ * and finish positions, so their index never changes from one update to
+ * another. Edges between them are computed once against fixed polygons only,
+ * then only checked against dynamic polygons on each update. */
+static uint8_t static_points_count = 0;
+static graph_bitset_t static_graph[GRAPH_MAX_VERTICES];
+static uint8_t static_graph_valid = FALSE;
 
 static pose_t start_position = { .x = 0, .y = 0 };
 static pose_t finish_position = { .x = 0, .y = 0 };
 
+/* Goals inserted in the graph. First goal is finish position, others are
+ * stored right after fixed polygons points */
+static pose_t goals[AVOIDANCE_MAX_GOALS];
+static uint8_t goals_valid[AVOIDANCE_MAX_GOALS];
+static uint8_t goals_vertex[AVOIDANCE_MAX_GOALS];
+static uint8_t nb_goals = 1;
+
+/* Last search result: distance to start and parent of each vertex */
+static uint32_t search_distance[GRAPH_MAX_VERTICES];
+static int16_t search_parent[GRAPH_MAX_VERTICES];
+#ifdef AVOIDANCE_ASTAR
+/* A* heap keys: distance to start plus estimated distance to target */
+static uint32_t search_estimate[GRAPH_MAX_VERTICES];
+#endif
+
+/* Shortest path computed on last graph update */
+static avoidance_path_t shortest_path = { .count = 0 };
+/* Fingerprints of dynamic polygons known when shortest path was computed */
+static uint32_t path_fingerprints[POLY_MAX];
+static uint8_t path_nb_fingerprints = 0;
+
+/* Binary min-heap of vertices, ordered by their distance to start */
+typedef struct {
+    uint8_t vertices[GRAPH_MAX_VERTICES];   /* Heap ordered vertices */
+    int16_t position[GRAPH_MAX_VERTICES];   /* Vertex position in heap, -1 if
+                                               not in heap */
+    uint8_t count;                          /* Number of vertices in heap */
+    const uint32_t *keys;                   /* Vertices ordering keys */
+} vertex_heap_t;
+
+/* Graph update steps */
+typedef enum {
+    AVOIDANCE_STEP_IDLE = 0,    /* No update in progress */
+    AVOIDANCE_STEP_STATIC,      /* Computing fixed polygons edges */
+    AVOIDANCE_STEP_CACHED,      /* Checking fixed polygons edges against
+                                   dynamic polygons */
+    AVOIDANCE_STEP_DYNAMIC,     /* Computing start, goals and dynamic
+                                   polygons points edges */
+    AVOIDANCE_STEP_SEARCH,      /* Searching shortest paths */
+} avoidance_step_t;
+
+/* Graph update state, kept between calls so an update can be suspended when
+ * its time budget is exhausted and resumed later */
+static struct {
+    avoidance_step_t step;
+    int index;                      /* Update result, see update_graph() */
+    uint8_t select_finish;          /* Store path to finish once done */
+    uint32_t start_time;            /* Current call start time (us) */
+    uint32_t budget;                /* Current call time budget (us), 0 if
+                                       unlimited */
+    int row;                        /* Next graph row to compute */
+    int static_end;                 /* End of fixed polygons points */
+    uint8_t masked[MAX_POINTS];     /* Points left unconnected */
+    graph_bitset_t targets;         /* Search targets */
+    graph_bitset_t checked;         /* Settled vertices */
+    graph_bitset_t remaining;       /* Targets not settled yet */
+    vertex_heap_t heap;             /* Search open set */
+#ifdef AVOIDANCE_ASTAR
+    int target;                     /* Single target, -1 if several */
+#endif
+} update = { .step = AVOIDANCE_STEP_IDLE };
+
+static inline void bitset_set(graph_bitset_t bitset, int bit)
+{
+    bitset[bit / GRAPH_WORD_BITS] |= ((uint32_t)1 << (bit % GRAPH_WORD_BITS));
+}
+
+static inline void bitset_clear(graph_bitset_t bitset, int bit)
+{
+    bitset[bit / GRAPH_WORD_BITS] &= ~((uint32_t)1 << (bit % GRAPH_WORD_BITS));
+}
+
+static inline uint8_t bitset_test(const graph_bitset_t bitset, int bit)
+{
+    return (bitset[bit / GRAPH_WORD_BITS] >> (bit % GRAPH_WORD_BITS)) & 1;
+}
+
+static inline uint8_t bitset_is_empty(const graph_bitset_t bitset)
+{
+    for (int w = 0; w < GRAPH_WORDS; w++) {
+        if (bitset[w]) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void build_start(void);
+static uint8_t build_step(void);
+static void search_start(const graph_bitset_t targets);
+static uint8_t search_step(void);
+static int build_path(uint16_t target);
+
+/* Broadphase: a point strictly outside the polygon bounding box can not be
+ * inside the polygon */
+static inline uint8_t is_point_in_bounding_box(const bounding_box_t *bbox, pose_t p)
+{
+    return (p.x >= bbox->x_min) && (p.x <= bbox->x_max)
+           && (p.y >= bbox->y_min) && (p.y <= bbox->y_max);
+}
+
+/* Broadphase: a segment which bounding box does not overlap the polygon one
+ * can not cross the polygon */
+static inline uint8_t is_segment_in_bounding_box(const bounding_box_t *bbox, pose_t a, pose_t b)
+{
+    return (MAX(a.x, b.x) >= bbox->x_min) && (MIN(a.x, b.x) <= bbox->x_max)
+           && (MAX(a.y, b.y) >= bbox->y_min) && (MIN(a.y, b.y) <= bbox->y_max);
+}
+
+static void compute_bounding_box(polygon_t *polygon)
+{
+    bounding_box_t *bbox = &polygon->bbox;
+
+    /* Only the circle is an obstacle */
+    if (polygon->is_circle) {
+        bbox->x_min = polygon->circle.center.x - polygon->circle.radius;
+        bbox->x_max = polygon->circle.center.x + polygon->circle.radius;
+        bbox->y_min = polygon->circle.center.y - polygon->circle.radius;
+        bbox->y_max = polygon->circle.center.y + polygon->circle.radius;
+        return;
+    }
+
+    bbox->x_min = bbox->x_max = polygon->points[0].x;
+    bbox->y_min = bbox->y_max = polygon->points[0].y;
+
+    for (int i = 1; i < polygon->count; i++) {
+        bbox->x_min = MIN(bbox->x_min, polygon->points[i].x);
+        bbox->x_max = MAX(bbox->x_max, polygon->points[i].x);
+        bbox->y_min = MIN(bbox->y_min, polygon->points[i].y);
+        bbox->y_max = MAX(bbox->y_max, polygon->points[i].y);
+    }
+}
+
 pose_t avoidance(uint8_t index)
 {
-    /* Build path graph */
-    return dijkstra(1, index);
+    /* No path computed, stay on start position */
+    if (shortest_path.count == 0) {
+        return start_position;
+    }
+
+    /* Last pose is returned once path end is reached */
+    if (index >= shortest_path.count) {
+        index = shortest_path.count - 1;
+    }
+
+    return shortest_path.poses[index];
 }
 
-int update_graph(const pose_t *s, const pose_t *f)
+const avoidance_path_t *avoidance_get_path(void)
 {
-    start_position = *s;
-    finish_position = *f;
-    int index = 1;
+    return &shortest_path;
+}
+
+uint8_t avoidance_get_vertices_count(void)
+{
+    return valid_points_count;
+}
 
-    if (!is_point_in_polygon(&borders, finish_position)) {
-        goto update_graph_error_finish_position;
+uint16_t avoidance_get_edges_count(void)
+{
+    uint16_t count = 0;
+
+    for (int p = 0; p < valid_points_count; p++) {
+        for (int w = 0; w < GRAPH_WORDS; w++) {
+            count += __builtin_popcount(graph[p][w]);
+        }
+    }
+
+    /* Each edge is stored in both directions */
+    return count / 2;
+}
+
+/* Live polygon at position i, fixed polygons are in [0, nb_polygons[ and
+ * dynamic ones in [nb_polygons, nb_polygons + nb_dyn_polygons[ */
+static inline polygon_t *live_polygon(int i)
+{
+    return &polygons[live_polygons[i]];
+}
+
+/* Check if point is inside borders and outside any polygon */
+static uint8_t is_point_valid_goal(pose_t p)
+{
+    if (!is_point_in_polygon(&borders, p)) {
+        return FALSE;
     }
 
-    /* Check that start and destination point are not in a polygon */
     for (int i = 0; i < (nb_polygons + nb_dyn_polygons); i++) {
-        if (is_point_in_polygon(&polygons[i], finish_position)) {
-            goto update_graph_error_finish_position;
+        const polygon_t *polygon = live_polygon(i);
+        if (is_point_in_bounding_box(&polygon->bbox, p)
+            && is_point_in_polygon(polygon, p)) {
+            return FALSE;
         }
-        if (is_point_in_polygon(&polygons[i], start_position)) {
+    }
+
+    return TRUE;
+}
+
+/* Set start position, moving it out of any polygon it could be in.
+ * Return 0 if start position has been moved, 1 otherwise */
+static int set_start_position(const pose_t *s)
+{
+    int index = 1;
+
+    start_position = *s;
+
+    for (int i = 0; i < (nb_polygons + nb_dyn_polygons); i++) {
+        polygon_t *polygon = live_polygon(i);
+        if (is_point_in_bounding_box(&polygon->bbox, start_position)
+            && is_point_in_polygon(polygon, start_position)) {
             // find nearest polygon point
             double min = DIJKSTRA_MAX_DISTANCE;
             pose_t *pose_tmp = &start_position;
-            for (int j = 0; j < polygons[i].count; j++) {
-                if (!is_point_in_polygon(&borders, polygons[i].points[j])) {
+            for (int j = 0; j < polygon->count; j++) {
+                if (!is_point_in_polygon(&borders, polygon->points[j])) {
                     continue;
                 }
 
-                double distance = distance_points(&start_position, &polygons[i].points[j]);
+                double distance = distance_points(&start_position, &polygon->points[j]);
                 if (distance < min) {
                     min = distance;
-                    pose_tmp = &polygons[i].points[j];
+                    pose_tmp = &polygon->points[j];
                 }
             }
 
@@ -64,34 +285,246 @@ int update_graph(const pose_t *s, const pose_t *f)
         }
     }
 
-    valid_points_count = 0;
-    valid_points[valid_points_count++] = start_position;
-    valid_points[valid_points_count++] = finish_position;
-
-    build_avoidance_graph();
+    valid_points[AVOIDANCE_START_INDEX] = start_position;
+#ifdef AVOIDANCE_REDUCED_GRAPH
+    valid_points_polygon[AVOIDANCE_START_INDEX] = -1;
+#endif
 
     return index;
+}
+
+/* Set goals to insert in graph, return the number of valid goals */
+static int set_goals(const pose_t *g, uint8_t count)
+{
+    int nb_valid = 0;
+
+    nb_goals = MIN(count, AVOIDANCE_MAX_GOALS);
+
+    for (int i = 0; i < nb_goals; i++) {
+        goals[i] = g[i];
+        goals_valid[i] = is_point_valid_goal(goals[i]);
+        nb_valid += goals_valid[i];
+    }
+
+    return nb_valid;
+}
+
+/* Check if current call time budget is exhausted */
+static inline uint8_t is_budget_exhausted(void)
+{
+    return update.budget
+           && ((xtimer_now_usec() - update.start_time) >= update.budget);
+}
+
+/* Obstacles changed, pending update is useless and has to begin again */
+static void cancel_update(void)
+{
+    if (update.step != AVOIDANCE_STEP_IDLE) {
+        update.step = AVOIDANCE_STEP_IDLE;
+        update.index = AVOIDANCE_UPDATE_CANCELLED;
+    }
+}
+
+int avoidance_update_begin(const pose_t *s, const pose_t *f)
+{
+    update.step = AVOIDANCE_STEP_IDLE;
+    update.index = AVOIDANCE_GRAPH_ERROR;
+
+    if (!set_goals(f, 1)) {
+        goto avoidance_update_begin_error_finish_position;
+    }
+    finish_position = *f;
 
-update_graph_error_finish_position:
+    update.index = set_start_position(s);
+    update.select_finish = TRUE;
+    memset(update.targets, 0, sizeof(update.targets));
+    bitset_set(update.targets, AVOIDANCE_FINISH_INDEX);
+
+    build_start();
+
+    return 0;
+
+avoidance_update_begin_error_finish_position:
     return AVOIDANCE_GRAPH_ERROR;
 }
 
+int avoidance_update_resume(uint32_t budget_us)
+{
+    update.start_time = xtimer_now_usec();
+    update.budget = budget_us;
+
+    if (update.step == AVOIDANCE_STEP_IDLE) {
+        return update.index;
+    }
+
+    if (update.step != AVOIDANCE_STEP_SEARCH) {
+        if (!build_step()) {
+            return AVOIDANCE_UPDATE_PENDING;
+        }
+        search_start(update.targets);
+    }
+
+    if (!search_step()) {
+        return AVOIDANCE_UPDATE_PENDING;
+    }
+
+    /* New path replaces the previous one only once complete */
+    if (update.select_finish) {
+        build_path(AVOIDANCE_FINISH_INDEX);
+    }
+
+    return update.index;
+}
+
+uint8_t avoidance_update_is_pending(void)
+{
+    /* Cancelled update is still reported to resume caller */
+    return (update.step != AVOIDANCE_STEP_IDLE)
+           || (update.index == AVOIDANCE_UPDATE_CANCELLED);
+}
+
+int update_graph(const pose_t *s, const pose_t *f)
+{
+    /* Invalidate previous path */
+    shortest_path.count = 0;
+
+    if (avoidance_update_begin(s, f) < 0) {
+        return AVOIDANCE_GRAPH_ERROR;
+    }
+
+    /* Compute the whole path once, it is used until next graph update */
+    return avoidance_update_resume(0);
+}
+
+int avoidance_update_begin_goals(const pose_t *s, const pose_t *g, uint8_t count)
+{
+    update.step = AVOIDANCE_STEP_IDLE;
+    update.index = AVOIDANCE_GRAPH_ERROR;
+
+    if (!set_goals(g, count)) {
+        goto avoidance_update_begin_goals_error_no_valid_goal;
+    }
+
+    update.index = set_start_position(s);
+    update.select_finish = FALSE;
+
+    build_start();
+
+    /* Single search for all goals */
+    memset(update.targets, 0, sizeof(update.targets));
+    for (int i = 0; i < nb_goals; i++) {
+        if (goals_valid[i]) {
+            bitset_set(update.targets, goals_vertex[i]);
+        }
+    }
+
+    return 0;
+
+avoidance_update_begin_goals_error_no_valid_goal:
+    return AVOIDANCE_GRAPH_ERROR;
+}
+
+int update_graph_goals(const pose_t *s, const pose_t *g, uint8_t count)
+{
+    /* Invalidate previous path */
+    shortest_path.count = 0;
+
+    if (avoidance_update_begin_goals(s, g, count) < 0) {
+        return AVOIDANCE_GRAPH_ERROR;
+    }
+
+    return avoidance_update_resume(0);
+}
+
+uint32_t avoidance_get_goal_distance(uint8_t goal)
+{
+    if ((goal >= nb_goals) || (!goals_valid[goal])) {
+        return DIJKSTRA_MAX_DISTANCE;
+    }
+
+    return search_distance[goals_vertex[goal]];
+}
+
+int avoidance_select_goal(uint8_t goal)
+{
+    if (avoidance_get_goal_distance(goal) >= DIJKSTRA_MAX_DISTANCE) {
+        return -1;
+    }
+
+    finish_position = goals[goal];
+
+    return build_path(goals_vertex[goal]);
+}
+
 double distance_points(pose_t *a, pose_t *b)
 {
     return sqrt((b->x - a->x) * (b->x - a->x)
                 + (b->y - a->y) * (b->y - a->y));
 }
 
+/* Take an entry from obstacles pool, return -1 if pool is full */
+static int alloc_polygon(void)
+{
+    int index = free_polygons_head;
+
+    if (index >= 0) {
+        free_polygons_head = free_polygons_next[index];
+    }
+    else if (nb_pool_polygons < POLY_MAX) {
+        index = nb_pool_polygons++;
+    }
+
+    return index;
+}
+
+/* Give an entry back to obstacles pool */
+static void release_polygon(int index)
+{
+    free_polygons_next[index] = free_polygons_head;
+    free_polygons_head = index;
+}
+
+/* Put pool entry index at live position */
+static inline void set_live_polygon(int position, int index)
+{
+    live_polygons[position] = index;
+    live_positions[index] = position;
+}
+
+/* Handle is valid if it references a live dynamic polygon */
+static uint8_t is_dyn_polygon_handle_valid(int handle)
+{
+    return (handle >= 0) && (handle < nb_pool_polygons)
+           && (live_positions[handle] >= nb_polygons)
+           && (live_positions[handle] < (nb_polygons + nb_dyn_polygons))
+           && (live_polygons[live_positions[handle]] == handle);
+}
+
 /* Add a polygon to obstacle list */
 int add_polygon(polygon_t *polygon)
 {
-    if (nb_polygons < POLY_MAX) {
-        polygons[nb_polygons++] = *polygon;
-        return 0;
-    }
-    else {
+    int index = alloc_polygon();
+
+    if (index < 0) {
         return -1;
     }
+
+    /* Fixed polygons are listed before dynamic ones, first dynamic one is
+     * moved at the end to make room */
+    if (nb_dyn_polygons > 0) {
+        set_live_polygon(nb_polygons + nb_dyn_polygons, live_polygons[nb_polygons]);
+    }
+    set_live_polygon(nb_polygons++, index);
+
+    polygons[index] = *polygon;
+    /* Plain polygon, circle fields given by caller are ignored */
+    polygons[index].is_circle = FALSE;
+    compute_bounding_box(&polygons[index]);
+    /* Fixed part of the graph has to be computed again */
+    static_graph_valid = FALSE;
+    cancel_update();
+
+    return 0;
 }
 
 int check_polygon_collision(pose_t *point)
@@ -100,7 +533,9 @@ int check_polygon_collision(pose_t *point)
         return TRUE;
 
     for (int i = 0; i < (nb_polygons + nb_dyn_polygons); i++) {
-        if (is_point_in_polygon(&polygons[i], *point)) {
+        const polygon_t *polygon = live_polygon(i);
+        if (is_point_in_bounding_box(&polygon->bbox, *point)
+            && is_point_in_polygon(polygon, *point)) {
             return TRUE;
         }
     }
@@ -108,110 +543,537 @@ int check_polygon_collision(pose_t *point)
     return FALSE;
 }
 
-/* Add a dynamic polygon to obstacle list */
-int add_dyn_polygon(polygon_t *polygon)
+/* Add a dynamic polygon, circle or not, to obstacle list, return its handle
+ * or -1 if obstacle list is full */
+static int insert_dyn_polygon(const polygon_t *polygon, uint8_t is_circle)
 {
-    if ((nb_polygons + nb_dyn_polygons) < POLY_MAX) {
-        polygons[nb_polygons + nb_dyn_polygons] = *polygon;
-        nb_dyn_polygons++;
-        return 0;
+    int index = alloc_polygon();
+
+    if (index < 0) {
+        return -1;
     }
-    else {
+
+    set_live_polygon(nb_polygons + nb_dyn_polygons++, index);
+
+    polygons[index] = *polygon;
+    polygons[index].is_circle = is_circle;
+    compute_bounding_box(&polygons[index]);
+    cancel_update();
+
+    return index;
+}
+
+/* Replace shape of dynamic polygon handle, circle or not */
+static int replace_dyn_polygon(int handle, const polygon_t *polygon, uint8_t is_circle)
+{
+    if (!is_dyn_polygon_handle_valid(handle)) {
         return -1;
     }
+
+    polygons[handle] = *polygon;
+    polygons[handle].is_circle = is_circle;
+    compute_bounding_box(&polygons[handle]);
+    cancel_update();
+
+    return 0;
+}
+
+/* Add a dynamic polygon to obstacle list, return its handle or -1 if
+ * obstacle list is full. Circle fields given by caller are ignored. */
+int add_dyn_polygon(polygon_t *polygon)
+{
+    return insert_dyn_polygon(polygon, FALSE);
+}
+
+/* Replace shape of dynamic polygon handle by a plain polygon */
+int update_dyn_polygon(int handle, polygon_t *polygon)
+{
+    return replace_dyn_polygon(handle, polygon, FALSE);
+}
+
+/* Remove dynamic polygon handle, last dynamic polygon takes its place */
+int remove_dyn_polygon(int handle)
+{
+    int last = nb_polygons + nb_dyn_polygons - 1;
+
+    if (!is_dyn_polygon_handle_valid(handle)) {
+        return -1;
+    }
+
+    set_live_polygon(live_positions[handle], live_polygons[last]);
+    nb_dyn_polygons--;
+    release_polygon(handle);
+    cancel_update();
+
+    return 0;
+}
+
+/* Regular polygon around circle: each side lies on a line tangent to the
+ * circle, so visibility edges can go round the circle closely. Its corners
+ * are 1/cos(pi/AVOIDANCE_CIRCLE_POINTS) times the radius away from center,
+ * so paths are a bit longer than with exact tangent points, which would
+ * depend on each edge other end and could not be cached in the graph. */
+static void circle_to_polygon(const circle_t *circle, polygon_t *polygon)
+{
+    double radius = (circle->radius + AVOIDANCE_CIRCLE_MARGIN)
+                    / cos(M_PI / AVOIDANCE_CIRCLE_POINTS);
+
+    polygon->count = AVOIDANCE_CIRCLE_POINTS;
+    for (int i = 0; i < AVOIDANCE_CIRCLE_POINTS; i++) {
+        double angle = (2 * M_PI * i) / AVOIDANCE_CIRCLE_POINTS;
+        polygon->points[i] = (pose_t){.x = circle->center.x + radius * cos(angle),
+                                      .y = circle->center.y + radius * sin(angle) };
+    }
+    polygon->circle = *circle;
+}
+
+/* Add a dynamic circle to obstacle list, return its handle or -1 if
+ * obstacle list is full. Its graph points are the corners of a regular
+ * polygon around it. */
+int add_dyn_circle(const circle_t *circle)
+{
+    polygon_t polygon;
+
+    circle_to_polygon(circle, &polygon);
+
+    return insert_dyn_polygon(&polygon, TRUE);
+}
+
+/* Move or resize dynamic circle handle */
+int update_dyn_circle(int handle, const circle_t *circle)
+{
+    polygon_t polygon;
+
+    circle_to_polygon(circle, &polygon);
+
+    return replace_dyn_polygon(handle, &polygon, TRUE);
 }
 
 void reset_dyn_polygons(void)
 {
+    for (int i = nb_polygons; i < (nb_polygons + nb_dyn_polygons); i++) {
+        release_polygon(live_polygons[i]);
+    }
     nb_dyn_polygons = 0;
+    cancel_update();
 }
 
-/* Build obstacle graph
- * Each obstacle is a polygon.
- * List all  visible points : all points not contained in a polygon */
-void build_avoidance_graph(void)
+/* Check if point p is inside one of the live polygons in [first, last[,
+ * except polygon skip */
+static uint8_t is_point_in_polygons(pose_t p, int first, int last, int skip)
 {
-    /* For each polygon */
-    for (int i = 0; i < (nb_polygons + nb_dyn_polygons); i++) {
-        /* and for each vertice of that polygon */
-        for (int p = 0; p < polygons[i].count; p++) {
-            uint8_t collide = FALSE;
-            /* Check if point is inside borders */
-            if (!is_point_in_polygon(&borders, polygons[i].points[p])) {
+    for (int i = first; i < last; i++) {
+        const polygon_t *polygon = live_polygon(i);
+        if ((i == skip) || (!is_point_in_bounding_box(&polygon->bbox, p))) {
+            continue;
+        }
+        if (is_point_in_polygon(polygon, p)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Segment [a, b] crosses circle if its closest point to circle center is
+ * inside the circle */
+static uint8_t is_segment_crossing_circle(pose_t a, pose_t b, const circle_t *circle)
+{
+    vector_t ab = { .x = b.x - a.x, .y = b.y - a.y };
+    vector_t ac = { .x = circle->center.x - a.x, .y = circle->center.y - a.y };
+    double length2 = ab.x * ab.x + ab.y * ab.y;
+    double t = (length2 > 0) ? ((ac.x * ab.x + ac.y * ab.y) / length2) : 0;
+    double dx, dy;
+
+    t = MAX(0, MIN(1, t));
+    dx = ac.x - t * ab.x;
+    dy = ac.y - t * ab.y;
+
+    return (dx * dx + dy * dy) < (circle->radius * circle->radius);
+}
+
+/* Check if segment [a, b] crosses one of the live polygons in [first, last[ */
+static uint8_t is_segment_crossing_polygons(pose_t a, pose_t b, int first, int last)
+{
+    for (int i = first; i < last; i++) {
+        const polygon_t *polygon = live_polygon(i);
+
+        if (!is_segment_in_bounding_box(&polygon->bbox, a, b)) {
+            continue;
+        }
+
+        if (polygon->is_circle) {
+            if (is_segment_crossing_circle(a, b, &polygon->circle)) {
+                return TRUE;
+            }
+            continue;
+        }
+
+        /* Special case of internal crossing of a polygon */
+        int8_t index = get_point_index_in_polygon(polygon, a);
+        int8_t index2 = get_point_index_in_polygon(polygon, b);
+        uint8_t is_polygon_side = ((index == 0) && (index2 == (polygon->count - 1)))
+                                  || ((index2 == 0) && (index == (polygon->count - 1)));
+        if ((!is_polygon_side) && (index >= 0) && (index2 >= 0) && (abs(index - index2) != 1)) {
+            return TRUE;
+        }
+
+        for (int v = 0; v < polygon->count; v++) {
+            pose_t p_next = ((v + 1 == polygon->count) ? polygon->points[0] : polygon->points[v + 1]);
+
+            if (is_segment_crossing_segment(a, b, polygon->points[v], p_next)) {
+                return TRUE;
+            }
+            if ((!is_polygon_side) && is_point_on_segment(a, b, polygon->points[v])) {
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+/* Iterate over all bits set in word, from lowest to highest, using count
+ * trailing zeros instruction. Variable bit is the bit index in the bitset. */
+#define BITSET_WORD_FOREACH(word, w, bit) \
+    for (uint32_t word_bits = (word); \
+         word_bits && ((bit = (w) * GRAPH_WORD_BITS + __builtin_ctz(word_bits)), 1); \
+         word_bits &= word_bits - 1)
+
+static inline uint16_t *graph_weight(int p, int p2)
+{
+    if (p < p2) {
+        int tmp = p;
+        p = p2;
+        p2 = tmp;
+    }
+
+    return &weights[(p * (p - 1)) / 2 + p2];
+}
+
+static inline void graph_set_edge(graph_bitset_t *g, int p, int p2, uint8_t visible)
+{
+    if (visible) {
+        /* Single precision is hardware accelerated on Cortex-M4F */
+        float dx = (float)(valid_points[p].x - valid_points[p2].x);
+        float dy = (float)(valid_points[p].y - valid_points[p2].y);
+
+        /* Rounded up, so that paths are never shorter than straight line
+         * and A* heuristic stays admissible */
+        *graph_weight(p, p2) = (uint16_t)ceilf(sqrtf(dx * dx + dy * dy));
+        bitset_set(g[p], p2);
+        bitset_set(g[p2], p);
+    }
+    else {
+        bitset_clear(g[p], p2);
+        bitset_clear(g[p2], p);
+    }
+}
+
+#ifdef AVOIDANCE_REDUCED_GRAPH
+/* Sign of the cross product (b - a) x (c - a) */
+static inline int8_t orientation(pose_t a, pose_t b, pose_t c)
+{
+    double d = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+
+    return (d > 0) - (d < 0);
+}
+
+/* Polygons are counterclockwise, a shortest path can only bend at a vertex
+ * turning left */
+static uint8_t is_vertex_convex(const polygon_t *polygon, int v)
+{
+    pose_t prev = polygon->points[(v + polygon->count - 1) % polygon->count];
+    pose_t next = polygon->points[(v + 1) % polygon->count];
+
+    return orientation(prev, polygon->points[v], next) > 0;
+}
+
+/* Line (a, b) is tangent to the polygon at b if both polygon neighbours of b
+ * are on the same side of it */
+static uint8_t is_tangent_at(int a, int b)
+{
+    const polygon_t *polygon;
+    int v;
+
+    if (valid_points_polygon[b] < 0) {
+        return TRUE;
+    }
+
+    polygon = &polygons[(int)valid_points_polygon[b]];
+    v = valid_points_vertex[b];
+
+    /* Circle polygon points are not on the obstacle itself */
+    if (polygon->is_circle) {
+        return TRUE;
+    }
+
+    return orientation(valid_points[a], valid_points[b],
+                       polygon->points[(v + polygon->count - 1) % polygon->count])
+           * orientation(valid_points[a], valid_points[b],
+                         polygon->points[(v + 1) % polygon->count]) >= 0;
+}
+
+/* Only bitangent edges can be part of a shortest path */
+static inline uint8_t is_edge_useful(int p, int p2)
+{
+    return is_tangent_at(p, p2) && is_tangent_at(p2, p);
+}
+
+/* Store point of live polygon i, vertex v, as graph vertex p */
+static inline uint8_t set_polygon_point(int p, int i, int v)
+{
+    if (!is_vertex_convex(live_polygon(i), v)) {
+        return FALSE;
+    }
+
+    valid_points[p] = live_polygon(i)->points[v];
+    valid_points_polygon[p] = live_polygons[i];
+    valid_points_vertex[p] = v;
+
+    return TRUE;
+}
+#else
+static inline uint8_t is_edge_useful(int p, int p2)
+{
+    (void)p;
+    (void)p2;
+
+    return TRUE;
+}
+
+static inline uint8_t set_polygon_point(int p, int i, int v)
+{
+    valid_points[p] = live_polygon(i)->points[v];
+
+    return TRUE;
+}
+#endif
+
+/* List valid points of fixed polygons.
+ * Edges between them are then computed against fixed polygons only. */
+static void list_static_points(void)
+{
+    static_points_count = 0;
+
+    for (int i = 0; i < nb_polygons; i++) {
+        for (int p = 0; p < live_polygon(i)->count; p++) {
+            pose_t point = live_polygon(i)->points[p];
+            /* Check if point is inside borders and not inside an other fixed
+             * polygon */
+            if ((!is_point_in_polygon(&borders, point))
+                || is_point_in_polygons(point, 0, nb_polygons, i)) {
                 continue;
             }
+            static_points_count += set_polygon_point(AVOIDANCE_STATIC_INDEX + static_points_count, i, p);
+        }
+    }
 
-            /* Check if this vertice is not inside an other polygon */
-            for (int j = 0; j < (nb_polygons + nb_dyn_polygons); j++) {
-                if (i == j) {
-                    continue;
-                }
-                if (is_point_in_polygon(&polygons[j], polygons[i].points[p])) {
-                    collide = TRUE;
-                    break;
-                }
+    memset(static_graph, 0, sizeof(static_graph));
+}
+
+/* Start graph building, start position and goals must be set */
+static void build_start(void)
+{
+    update.row = AVOIDANCE_STATIC_INDEX;
+
+    if (!static_graph_valid) {
+        list_static_points();
+        update.step = AVOIDANCE_STEP_STATIC;
+    }
+    else {
+        update.step = AVOIDANCE_STEP_CACHED;
+    }
+    update.static_end = AVOIDANCE_STATIC_INDEX + static_points_count;
+
+    /* Add goals, first one is the finish position */
+    valid_points_count = update.static_end;
+    for (int i = 0; i < nb_goals; i++) {
+        goals_vertex[i] = (i == 0) ? AVOIDANCE_FINISH_INDEX : valid_points_count++;
+        valid_points[goals_vertex[i]] = goals[i];
+#ifdef AVOIDANCE_REDUCED_GRAPH
+        valid_points_polygon[goals_vertex[i]] = -1;
+#endif
+        update.masked[goals_vertex[i]] = !goals_valid[i];
+    }
+    update.masked[AVOIDANCE_START_INDEX] = FALSE;
+}
+
+/* Compute fixed polygons edges of one point, return TRUE once done for all
+ * of them */
+static uint8_t build_static_row(void)
+{
+    int p = update.row;
+
+    if (p >= update.static_end) {
+        static_graph_valid = TRUE;
+        return TRUE;
+    }
+
+    for (int p2 = p + 1; p2 < update.static_end; p2++) {
+        graph_set_edge(static_graph, p, p2,
+                       is_edge_useful(p, p2)
+                       && (!is_segment_crossing_polygons(valid_points[p], valid_points[p2],
+                                                         0, nb_polygons)));
+    }
+
+    update.row++;
+
+    return FALSE;
+}
+
+/* Check cached edges of one fixed polygon point against dynamic polygons
+ * only, return TRUE once done for all of them */
+static uint8_t build_cached_row(void)
+{
+    int nb_all_polygons = nb_polygons + nb_dyn_polygons;
+    int p = update.row;
+
+    if (p == AVOIDANCE_STATIC_INDEX) {
+        memcpy(graph, static_graph, sizeof(graph));
+
+        /* Fixed polygons points hidden by a dynamic polygon are masked */
+        for (int i = AVOIDANCE_STATIC_INDEX; i < update.static_end; i++) {
+            update.masked[i] = is_point_in_polygons(valid_points[i], nb_polygons, nb_all_polygons, -1);
+        }
+    }
+
+    if (p >= update.static_end) {
+        return TRUE;
+    }
+
+    for (int w = (p + 1) / GRAPH_WORD_BITS; w < GRAPH_WORDS; w++) {
+        int p2;
+        BITSET_WORD_FOREACH(graph[p][w], w, p2) {
+            if (p2 <= p) {
+                continue;
             }
-            /* If that point is not in an other polygon, add it to the list of valid points */
-            if (!collide) {
-                valid_points[valid_points_count++] = polygons[i].points[p];
+            if (update.masked[p] || update.masked[p2]
+                || is_segment_crossing_polygons(valid_points[p], valid_points[p2],
+                                                nb_polygons, nb_all_polygons)) {
+                graph_set_edge(graph, p, p2, FALSE);
             }
         }
     }
 
-    /* For each segment of the valid points list */
-    for (int p = 0; p < valid_points_count; p++) {
-        for (int p2 = p + 1; p2 < valid_points_count; p2++) {
-            uint8_t collide = FALSE;
-            if (p != p2) {
-                /* Check if that segment crosses a polygon */
-                for (int i = 0; i < (nb_polygons + nb_dyn_polygons); i++) {
-                    for (int v = 0; v < polygons[i].count; v++) {
-                        pose_t p_next = ((v + 1 == polygons[i].count) ? polygons[i].points[0] : polygons[i].points[v + 1]);
-
-                        if (is_segment_crossing_segment(valid_points[p], valid_points[p2], polygons[i].points[v], p_next)) {
-                            collide = TRUE;
-                            break;
-                        }
-                        /* Special case of internal crossing of a polygon */
-                        int8_t index = get_point_index_in_polygon(&polygons[i], valid_points[p]);
-                        int8_t index2 = get_point_index_in_polygon(&polygons[i], valid_points[p2]);
-                        if ((index == 0) && (index2 == (polygons[i].count - 1))) {
-                            continue;
-                        }
-                        if ((index2 == 0) && (index == (polygons[i].count - 1))) {
-                            continue;
-                        }
-                        if ((index >= 0) && (index2 >= 0) && (abs(index - index2) != 1)) {
-                            collide = TRUE;
-                            break;
-                        }
-                        if (is_point_on_segment(valid_points[p], valid_points[p2], polygons[i].points[v])) {
-                            collide = TRUE;
-                            break;
-                        }
-                    }
-                    if (collide) {
-                        break;
-                    }
+    update.row++;
+
+    return FALSE;
+}
+
+/* Add valid points of dynamic polygons after goals */
+static void list_dynamic_points(void)
+{
+    int nb_all_polygons = nb_polygons + nb_dyn_polygons;
+
+    valid_points_count = update.static_end + nb_goals - 1;
+    for (int i = nb_polygons; i < nb_all_polygons; i++) {
+        /* and for each vertice of that polygon */
+        for (int p = 0; p < live_polygon(i)->count; p++) {
+            pose_t point = live_polygon(i)->points[p];
+            /* Check if point is inside borders and not inside an other
+             * polygon */
+            if ((!is_point_in_polygon(&borders, point))
+                || is_point_in_polygons(point, 0, nb_all_polygons, i)) {
+                continue;
+            }
+            update.masked[valid_points_count] = FALSE;
+            valid_points_count += set_polygon_point(valid_points_count, i, p);
+        }
+    }
+}
+
+/* Compute edges touching start, goals or dynamic polygons point, return TRUE
+ * once done for all of them */
+static uint8_t build_dynamic_row(void)
+{
+    int nb_all_polygons = nb_polygons + nb_dyn_polygons;
+    int p = update.row;
+
+    /* Fixed polygons points are only connected to the others from here */
+    if (p == AVOIDANCE_STATIC_INDEX) {
+        p = update.row = update.static_end;
+    }
+
+    if (p >= valid_points_count) {
+        return TRUE;
+    }
+
+    update.row++;
+
+    /* Invalid goals are left unconnected */
+    if (update.masked[p]) {
+        for (int w = 0; w < GRAPH_WORDS; w++) {
+            graph[p][w] = 0;
+        }
+        return FALSE;
+    }
+
+    for (int p2 = 0; p2 < valid_points_count; p2++) {
+        /* Each edge is computed once */
+        if ((p2 <= p) && ((p2 < AVOIDANCE_STATIC_INDEX) || (p2 >= update.static_end))) {
+            continue;
+        }
+        graph_set_edge(graph, p, p2,
+                       (!update.masked[p2])
+                       && is_edge_useful(p, p2)
+                       && (!is_segment_crossing_polygons(valid_points[p], valid_points[p2],
+                                                         0, nb_all_polygons)));
+    }
+
+    return FALSE;
+}
+
+/* Go on building graph, one point at a time, until it is done or the time
+ * budget is exhausted. Return TRUE once graph is built. */
+static uint8_t build_step(void)
+{
+    for (;;) {
+        switch (update.step) {
+            case AVOIDANCE_STEP_STATIC:
+                if (build_static_row()) {
+                    update.step = AVOIDANCE_STEP_CACHED;
+                    update.row = AVOIDANCE_STATIC_INDEX;
+                    continue;
                 }
-                /* If no collision, both points of the segment are added to the graph with distance between them */
-                if ((p < GRAPH_MAX_VERTICES) && (p2 < GRAPH_MAX_VERTICES)) {
-                    if (!collide) {
-                        graph[p] |= (1 << p2);
-                        graph[p2] |= (1 << p);
-                    }
-                    else {
-                        graph[p] &= ~(1 << p2);
-                        graph[p2] &= ~(1 << p);
-                    }
+                break;
+            case AVOIDANCE_STEP_CACHED:
+                if (build_cached_row()) {
+                    list_dynamic_points();
+                    update.step = AVOIDANCE_STEP_DYNAMIC;
+                    update.row = AVOIDANCE_START_INDEX;
+                    continue;
                 }
-            }
+                break;
+            case AVOIDANCE_STEP_DYNAMIC:
+                if (build_dynamic_row()) {
+                    update.step = AVOIDANCE_STEP_SEARCH;
+                    return TRUE;
+                }
+                break;
+            default:
+                return TRUE;
+        }
+
+        if (is_budget_exhausted()) {
+            return FALSE;
         }
     }
-    /*for (int i = 0; i < 6; i++)
-       {
-        printf("graph[%d] = %llx\n", i, graph[i]);
-       }*/
+}
+
+/* Build obstacle graph
+ * Each obstacle is a polygon.
+ * List all  visible points : all points not contained in a polygon.
+ *
+ * Graph is built incrementally: edges between fixed polygons are cached and
+ * only checked against dynamic polygons. Edges touching start, goals and
+ * dynamic polygons points are fully computed. */
+void build_avoidance_graph(void)
+{
+    update.budget = 0;
+    build_start();
+    build_step();
+    update.step = AVOIDANCE_STEP_IDLE;
 }
 
 uint8_t is_point_on_segment(pose_t a, pose_t b, pose_t o)
@@ -282,6 +1144,12 @@ uint8_t is_point_in_polygon(const polygon_t *polygon, pose_t p)
     pose_t a, b;
     vector_t ab, ap;
 
+    if (polygon->is_circle) {
+        ap.x = p.x - polygon->circle.center.x;
+        ap.y = p.y - polygon->circle.center.y;
+        return (ap.x * ap.x + ap.y * ap.y) < (polygon->circle.radius * polygon->circle.radius);
+    }
+
     for (i = 0; i < polygon->count; i++) {
         a = polygon->points[i];
         b = (i == (polygon->count - 1) ? polygon->points[0] : polygon->points[i + 1]);
@@ -301,75 +1169,280 @@ uint8_t is_point_in_polygon(const polygon_t *polygon, pose_t p)
     return TRUE;
 }
 
-pose_t dijkstra(uint16_t target, uint16_t index)
+static inline void heap_swap(vertex_heap_t *heap, int a, int b)
 {
-    uint8_t checked[GRAPH_MAX_VERTICES];
-    double distance[GRAPH_MAX_VERTICES];
-    uint16_t v;
+    uint8_t tmp = heap->vertices[a];
+
+    heap->vertices[a] = heap->vertices[b];
+    heap->vertices[b] = tmp;
+    heap->position[heap->vertices[a]] = a;
+    heap->position[heap->vertices[b]] = b;
+}
+
+static void heap_sift_up(vertex_heap_t *heap, int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap->keys[heap->vertices[parent]] <= heap->keys[heap->vertices[i]]) {
+            break;
+        }
+        heap_swap(heap, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(vertex_heap_t *heap, int i)
+{
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if ((left < heap->count)
+            && (heap->keys[heap->vertices[left]] < heap->keys[heap->vertices[smallest]])) {
+            smallest = left;
+        }
+        if ((right < heap->count)
+            && (heap->keys[heap->vertices[right]] < heap->keys[heap->vertices[smallest]])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        heap_swap(heap, i, smallest);
+        i = smallest;
+    }
+}
+
+/* Insert vertex v in heap, or move it up if its key decreased */
+static void heap_push_or_decrease(vertex_heap_t *heap, uint8_t v)
+{
+    if (heap->position[v] < 0) {
+        heap->vertices[heap->count] = v;
+        heap->position[v] = heap->count;
+        heap->count++;
+    }
+    heap_sift_up(heap, heap->position[v]);
+}
+
+static uint8_t heap_pop(vertex_heap_t *heap)
+{
+    uint8_t v = heap->vertices[0];
+
+    heap->count--;
+    if (heap->count > 0) {
+        heap_swap(heap, 0, heap->count);
+        heap_sift_down(heap, 0);
+    }
+    heap->position[v] = -1;
+
+    return v;
+}
+
+#ifdef AVOIDANCE_ASTAR
+/* Straight line distance from p to target, rounded down to stay below the
+ * sum of rounded up edges weights of any path */
+static inline uint32_t search_heuristic(int p, int target)
+{
+    float dx, dy;
+
+    if (target < 0) {
+        return 0;
+    }
+
+    dx = (float)(valid_points[p].x - valid_points[target].x);
+    dy = (float)(valid_points[p].y - valid_points[target].y);
+
+    return (uint32_t)sqrtf(dx * dx + dy * dy);
+}
+#endif
+
+/* Start searching shortest paths from start until all targets are settled.
+ * Result is stored in search_distance and search_parent.
+ * With AVOIDANCE_ASTAR, a single target search is guided by the straight
+ * line distance to that target. */
+static void search_start(const graph_bitset_t targets)
+{
+    vertex_heap_t *heap = &update.heap;
     int i;
-    double weight;
-    double min_distance;
-    int parent[GRAPH_MAX_VERTICES];
-    int child[GRAPH_MAX_VERTICES];
+    int nb_vertices = valid_points_count;
     /* TODO: start should be a parameter. More clean even if start is always index 0 in our case */
     int start = 0;
 
-    for (int i = 0; i <= valid_points_count; i++) {
-        checked[i] = FALSE;
-        distance[i] = DIJKSTRA_MAX_DISTANCE;
-        parent[i] = -1;
-    }
-
-    distance[start] = 0;
-    v = start;
-    if (graph[v] == 0) {
-        goto dijkstra_error_no_destination;
-    }
-
-    while ((v != target) && (checked[v] == FALSE)) {
-        min_distance = DIJKSTRA_MAX_DISTANCE;
-        checked[v] = TRUE;
-        for (i = 0; i < valid_points_count; i++) {
-            if (graph[v] & (1 << i)) {
-                weight = (valid_points[v].x - valid_points[i].x);
-                weight *= (valid_points[v].x - valid_points[i].x);
-                weight += (valid_points[v].y - valid_points[i].y)
-                          * (valid_points[v].y - valid_points[i].y);
-                weight = sqrt(weight);
-                if ((weight >= 0) && (distance[i] > (distance[v] + weight))) {
-                    distance[i] = distance[v] + weight;
-                    parent[i] = v;
+    update.step = AVOIDANCE_STEP_SEARCH;
+    memset(update.checked, 0, sizeof(update.checked));
+    memcpy(update.remaining, targets, sizeof(update.remaining));
+    for (i = 0; i < nb_vertices; i++) {
+        search_distance[i] = DIJKSTRA_MAX_DISTANCE;
+        search_parent[i] = -1;
+        heap->position[i] = -1;
+    }
+    heap->count = 0;
+    heap->keys = search_distance;
+
+#ifdef AVOIDANCE_ASTAR
+    /* Heuristic is only admissible for a single target */
+    update.target = -1;
+    for (int w = 0; w < GRAPH_WORDS; w++) {
+        BITSET_WORD_FOREACH(targets[w], w, i) {
+            update.target = (update.target == -1) ? i : -2;
+        }
+    }
+    if (update.target < 0) {
+        update.target = -1;
+    }
+    heap->keys = search_estimate;
+#endif
+
+    if (bitset_is_empty(graph[start])) {
+        return;
+    }
+
+    search_distance[start] = 0;
+#ifdef AVOIDANCE_ASTAR
+    search_estimate[start] = search_heuristic(start, update.target);
+#endif
+    heap_push_or_decrease(heap, start);
+}
+
+/* Go on searching until all targets are settled or the time budget is
+ * exhausted. Return TRUE once search is done. */
+static uint8_t search_step(void)
+{
+    vertex_heap_t *heap = &update.heap;
+    uint16_t v;
+    int i;
+    int nb_words = (valid_points_count + GRAPH_WORD_BITS - 1) / GRAPH_WORD_BITS;
+
+    while (heap->count > 0) {
+        v = heap_pop(heap);
+        bitset_set(update.checked, v);
+        /* Stop once all targets are settled */
+        bitset_clear(update.remaining, v);
+        if (bitset_is_empty(update.remaining)) {
+            break;
+        }
+        /* Word parallel iteration over unchecked neighbours */
+        for (int w = 0; w < nb_words; w++) {
+            BITSET_WORD_FOREACH(graph[v][w] & ~update.checked[w], w, i) {
+                uint32_t new_distance = search_distance[v] + *graph_weight(v, i);
+                if (new_distance < search_distance[i]) {
+                    search_distance[i] = new_distance;
+                    search_parent[i] = v;
+#ifdef AVOIDANCE_ASTAR
+                    search_estimate[i] = new_distance + search_heuristic(i, update.target);
+#endif
+                    heap_push_or_decrease(heap, i);
                 }
             }
         }
-        for (i = 1; i < valid_points_count; i++) {
-            if ((checked[i] == FALSE) && (min_distance > distance[i])) {
-                min_distance = distance[i];
-                v = i;
-            }
+        if (is_budget_exhausted()) {
+            return FALSE;
         }
     }
 
-    /* Build reverse path (from start to finish) */
-    i = 1;
-    while (parent[i] >= 0) {
-        child[parent[i]] = i;
-        i = parent[i];
+    update.step = AVOIDANCE_STEP_IDLE;
+
+    return TRUE;
+}
+
+/* FNV-1a hash of polygon points coordinates, rounded to mm */
+static uint32_t polygon_fingerprint(const polygon_t *polygon)
+{
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < polygon->count; i++) {
+        hash = (hash ^ (uint32_t)(int32_t)polygon->points[i].x) * 16777619u;
+        hash = (hash ^ (uint32_t)(int32_t)polygon->points[i].y) * 16777619u;
+    }
+
+    return hash;
+}
+
+/* Store path from start to target from last search result */
+static int build_path(uint16_t target)
+{
+    uint8_t count;
+    int i;
+    /* TODO: start should be a parameter. More clean even if start is always index 0 in our case */
+    int start = 0;
+
+    /* Remember obstacles the path avoids */
+    path_nb_fingerprints = nb_dyn_polygons;
+    for (i = 0; i < nb_dyn_polygons; i++) {
+        path_fingerprints[i] = polygon_fingerprint(live_polygon(nb_polygons + i));
+    }
+
+    /* Path defaults to start position only */
+    shortest_path.poses[0] = valid_points[start];
+    shortest_path.count = 1;
+
+    if (search_parent[target] < 0) {
+        return -1;
+    }
+
+    /* Count poses from start to target */
+    count = 1;
+    for (i = target; i != start; i = search_parent[i]) {
+        count++;
+    }
+
+    /* Store path from start to target */
+    shortest_path.count = count;
+    for (i = target; count > 0; i = search_parent[i]) {
+        shortest_path.poses[--count] = valid_points[i];
     }
 
-    /* Find n child in graph */
-    i = 0;
-    v = 0;
-    while ((i != 1) && (v < index)) {
-        i = child[i];
-        v++;
+    return 0;
+}
+
+uint8_t avoidance_is_path_blocked(const pose_t *pose, uint8_t index)
+{
+    /* No path to follow, it has to be computed again */
+    if (shortest_path.count < 2) {
+        return TRUE;
     }
+    index = MIN(index, shortest_path.count - 1);
+
+    for (int i = nb_polygons; i < (nb_polygons + nb_dyn_polygons); i++) {
+        uint32_t fingerprint = polygon_fingerprint(live_polygon(i));
+        uint8_t known = FALSE;
+        pose_t a = *pose;
+
+        /* Only new or moved obstacles are checked */
+        for (int j = 0; (j < path_nb_fingerprints) && (!known); j++) {
+            known = (path_fingerprints[j] == fingerprint);
+        }
+        if (known) {
+            continue;
+        }
+
+        if (is_point_in_polygons(a, i, i + 1, -1)) {
+            return TRUE;
+        }
+        for (int j = index; j < shortest_path.count; j++) {
+            if (is_segment_crossing_polygons(a, shortest_path.poses[j], i, i + 1)) {
+                return TRUE;
+            }
+            a = shortest_path.poses[j];
+        }
+    }
+
+    return FALSE;
+}
+
+int dijkstra(uint16_t target)
+{
+    graph_bitset_t targets;
+
+    memset(targets, 0, sizeof(targets));
+    bitset_set(targets, target);
 
-    /* Return point */
-    return valid_points[i];
+    update.budget = 0;
+    search_start(targets);
+    search_step();
 
-dijkstra_error_no_destination:
-    return start_position;
+    return build_path(target);
 }
 
 int avoidance_print_dyn_obstacles(int argc, char **argv)
@@ -380,7 +1453,7 @@ int avoidance_print_dyn_obstacles(int argc, char **argv)
     printf("[");
 
     for(int i = nb_polygons ; i < nb_polygons + nb_dyn_polygons ; i++) {
-        polygon_t *polygon = &(polygons[i]);
+        polygon_t *polygon = live_polygon(i);
 
         if(i > nb_polygons) {
             printf(", ");
@@ -7,14 +7,34 @@
 #include "odometry.h"
 #include "platform.h"
 
-#define MAX_POINTS      256
 #define POLY_MAX        16
 #define POLY_MAX_POINTS 6
+/* Maximum number of goals searched at once, finish position included */
+#define AVOIDANCE_MAX_GOALS     8
+/* Start, goals and all polygons points */
+#define MAX_POINTS      (1 + AVOIDANCE_MAX_GOALS + POLY_MAX * POLY_MAX_POINTS)
 
-#define GRAPH_MAX_VERTICES      64
+#define GRAPH_MAX_VERTICES      MAX_POINTS
+/* Vertices are indexed on 8 bits */
+#if GRAPH_MAX_VERTICES > 255
+#error "GRAPH_MAX_VERTICES must not exceed 255"
+#endif
+/* Graph adjacency rows are multi-word bitsets */
+#define GRAPH_WORD_BITS         32
+#define GRAPH_WORDS             ((GRAPH_MAX_VERTICES + GRAPH_WORD_BITS - 1) / GRAPH_WORD_BITS)
 #define DIJKSTRA_MAX_DISTANCE   13000000
 
 #define AVOIDANCE_GRAPH_ERROR               -1
+#define AVOIDANCE_UPDATE_PENDING            -2
+#define AVOIDANCE_UPDATE_CANCELLED          -3
+
+/* Graph vertices layout: start, finish, fixed polygons points then dynamic
+ * polygons points */
+#define AVOIDANCE_START_INDEX   0
+#define AVOIDANCE_FINISH_INDEX  1
+#define AVOIDANCE_STATIC_INDEX  2
+
+typedef uint32_t graph_bitset_t[GRAPH_WORDS];
 
 /* Vector */
 /* TODO: should it be generic to all core functions ? */
@@ -22,21 +42,73 @@ typedef struct {
     double x, y;
 } vector_t;
 
+/* Axis aligned bounding box */
+typedef struct {
+    double x_min, x_max;
+    double y_min, y_max;
+} bounding_box_t;
+
+/* Circle */
+typedef struct {
+    pose_t center;
+    double radius;
+} circle_t;
+
 /* Polygon */
 /* TODO: should it be generic to all core functions ? */
 typedef struct {
     uint8_t count;
     pose_t points[POLY_MAX_POINTS];
+    bounding_box_t bbox;    /* Computed when polygon is added to obstacles */
+    uint8_t is_circle;      /* Obstacle is the circle, points only surround
+                               it */
+    circle_t circle;
 } polygon_t;
 
-pose_t dijkstra(uint16_t target, uint16_t index);
+/* Circle obstacle points are the corners of a regular polygon which sides are
+ * tangent to the circle enlarged by a margin (mm) */
+#define AVOIDANCE_CIRCLE_POINTS POLY_MAX_POINTS
+#define AVOIDANCE_CIRCLE_MARGIN 1
+
+/* Shortest path, from start to finish */
+typedef struct {
+    uint8_t count;
+    pose_t poses[GRAPH_MAX_VERTICES];
+} avoidance_path_t;
+
+int dijkstra(uint16_t target);
 pose_t avoidance(uint8_t index);
+const avoidance_path_t *avoidance_get_path(void);
+uint8_t avoidance_get_vertices_count(void);
+uint16_t avoidance_get_edges_count(void);
+/* Check if a new or moved dynamic polygon blocks the remaining part of the
+ * path, from pose to path index and then to finish */
+uint8_t avoidance_is_path_blocked(const pose_t *pose, uint8_t index);
 double distance_points(pose_t *a, pose_t *b);
 int update_graph(const pose_t *s, const pose_t *f);
+int update_graph_goals(const pose_t *s, const pose_t *g, uint8_t count);
+/* Graph update spread over several calls: begin, then resume with a time
+ * budget until it does not return AVOIDANCE_UPDATE_PENDING anymore. Last path
+ * is kept until the new one is complete. Adding, updating or removing
+ * obstacles cancels a pending update: resume then returns
+ * AVOIDANCE_UPDATE_CANCELLED until a new update begins. */
+int avoidance_update_begin(const pose_t *s, const pose_t *f);
+/* Same for several goals, path is then built by avoidance_select_goal() */
+int avoidance_update_begin_goals(const pose_t *s, const pose_t *g, uint8_t count);
+int avoidance_update_resume(uint32_t budget_us);
+uint8_t avoidance_update_is_pending(void);
+uint32_t avoidance_get_goal_distance(uint8_t goal);
+int avoidance_select_goal(uint8_t goal);
 void init_polygons(void);
 void build_avoidance_graph(void);
 int add_polygon(polygon_t *polygon);
+/* Dynamic polygons are referenced by the handle returned when added, or -1
+ * if obstacle list is full. Update and remove return -1 on invalid handle. */
 int add_dyn_polygon(polygon_t *polygon);
+int update_dyn_polygon(int handle, polygon_t *polygon);
+int remove_dyn_polygon(int handle);
+int add_dyn_circle(const circle_t *circle);
+int update_dyn_circle(int handle, const circle_t *circle);
 void reset_dyn_polygons(void);
 uint8_t is_point_in_polygon(const polygon_t *polygons, pose_t p);
 int8_t get_point_index_in_polygon(const polygon_t *polygons, pose_t p);
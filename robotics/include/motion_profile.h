@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * \struct motion_ramp_t
+ * \brief jerk limited speed change, speed is symmetric around ramp middle
+ */
+typedef struct {
+    double speed_start;     /*!< speed at ramp start */
+    double sign;            /*!< 1 to speed up, -1 to slow down */
+    double acc;             /*!< maximum acceleration reached */
+    double jerk;            /*!< jerk */
+    double jerk_time;       /*!< time to reach maximum acceleration */
+    double acc_time;        /*!< time at maximum acceleration */
+    double duration;        /*!< ramp duration */
+    double distance;        /*!< distance run during ramp */
+} motion_ramp_t;
+
+/**
+ * \struct motion_profile_t
+ * \brief speed profile from a start speed to stop at a given distance:
+ * speed up ramp, constant speed, slow down ramp
+ *
+ * Distances, speeds and times are in caller units, e.g. mm and control loop
+ * reference periods.
+ */
+typedef struct {
+    double direction;       /*!< 1 forward, -1 backward */
+    double distance;        /*!< segment length */
+    double speed;           /*!< constant speed reached */
+    motion_ramp_t speed_up; /*!< ramp from start speed to constant speed */
+    double cruise_time;     /*!< time at constant speed */
+    motion_ramp_t slow_down;/*!< ramp from constant speed to stop */
+    double duration;        /*!< profile duration */
+    double time;            /*!< time elapsed since profile start */
+} motion_profile_t;
+
+/**
+ * \fn motion_profile_plan
+ * \brief compute the fastest profile to run a segment and stop at its end
+ * \param profile motion profile
+ * \param distance segment length, negative to go backward
+ * \param speed_start current speed, kept for continuity if in distance
+ *        direction
+ * \param max_speed maximum speed
+ * \param max_acc maximum acceleration
+ * \param max_jerk maximum jerk
+ */
+void motion_profile_plan(motion_profile_t *profile, double distance,
+                         double speed_start, double max_speed,
+                         double max_acc, double max_jerk);
+
+/**
+ * \fn motion_profile_update
+ * \brief move forward in profile time and get setpoints
+ * \param profile motion profile
+ * \param dt time elapsed since previous update
+ * \param position distance run since segment start, never beyond segment end
+ * \param speed speed
+ */
+void motion_profile_update(motion_profile_t *profile, double dt,
+                           double *position, double *speed);
+
+/**
+ * \fn motion_profile_is_finished
+ * \brief check if profile end is reached
+ * \param profile motion profile
+ * \return TRUE if profile speed is back to 0
+ */
+uint8_t motion_profile_is_finished(const motion_profile_t *profile);
@@ -10,6 +10,7 @@ int8_t add_dyn_obstacle(const uint16_t dev,
                         double angle_offset,
                         double distance_offset,
                         double dist);
+uint8_t update_dyn_obstacles(void);
 
 static const polygon_t obstacle_borders = {
     .points = {
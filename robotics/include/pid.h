@@ -1,6 +1,7 @@
 #pragma once
 
-/* Set integral limit to PWM max (check in RIOT) for integrator windup */
+/* Set integral limit to PWM max (check in RIOT) for integrator windup,
+ * error sum is weighted by time step */
 #define INTEGRAL_LIMIT  2000
 
 /**
@@ -36,6 +37,8 @@ void pid_reset(PID_t *pid);
  * \brief compute pid controller
  * \param pid
  * \param error
+ * \param dt time step since previous call, in the time unit ki and kd are
+ *        tuned for, so gains do not depend on call rate
  * \return the variable that will be adjusted by the pid
  */
-double pid_ctrl(PID_t *pid, const double error);
+double pid_ctrl(PID_t *pid, const double error, const double dt);
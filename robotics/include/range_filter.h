@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Maximum median window size, median is computed on a sorted copy of the
+ * window so it has to stay small */
+#define RANGE_FILTER_MAX_SIZE   7
+
+/**
+ * \struct range_sample_t
+ */
+typedef struct {
+    uint16_t distance;      /*!< measured distance [mm] */
+    uint32_t timestamp;     /*!< measure time [us] */
+} range_sample_t;
+
+/**
+ * \struct range_filter_conf_t
+ */
+typedef struct {
+    uint8_t size;           /*!< median window size, 1 disables median */
+    uint16_t min;           /*!< obstacle detected above this distance [mm] */
+    uint16_t max;           /*!< obstacle detected below this distance [mm] */
+    uint16_t hysteresis;    /*!< detected obstacle released only above
+                                 max + hysteresis [mm] */
+} range_filter_conf_t;
+
+/**
+ * \struct range_filter_t
+ */
+typedef struct {
+    const range_filter_conf_t *conf;                /*!< configuration */
+    range_sample_t samples[RANGE_FILTER_MAX_SIZE];  /*!< last samples ring */
+    uint8_t index;          /*!< next sample index in ring */
+    uint8_t count;          /*!< number of samples in ring */
+    uint8_t detected;       /*!< obstacle currently detected */
+} range_filter_t;
+
+/**
+ * \fn range_filter_setup
+ * \brief range filter setup
+ * \param filter range filter
+ * \param conf filter configuration
+ */
+void range_filter_setup(range_filter_t *filter, const range_filter_conf_t *conf);
+
+/**
+ * \fn range_filter_reset
+ * \brief forget all samples
+ * \param filter range filter
+ */
+void range_filter_reset(range_filter_t *filter);
+
+/**
+ * \fn range_filter_update
+ * \brief add a sample and compute filtered one
+ * \param filter range filter
+ * \param sample new sample
+ * \param filtered median sample of the window
+ * \return TRUE if an obstacle is detected
+ */
+uint8_t range_filter_update(range_filter_t *filter, const range_sample_t *sample,
+                            range_sample_t *filtered);
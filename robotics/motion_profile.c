@@ -0,0 +1,157 @@
+#include <math.h>
+
+#include "motion_profile.h"
+#include "utils.h"
+
+/* Number of bisection steps to find profile constant speed */
+#define MOTION_PROFILE_SPEED_STEPS  16
+
+/* Plan speed change, acceleration increases and decreases at max_jerk */
+static void motion_ramp_plan(motion_ramp_t *ramp, double speed_start,
+                             double speed_end, double max_acc, double max_jerk)
+{
+    double delta = fabs(speed_end - speed_start);
+
+    ramp->speed_start = speed_start;
+    ramp->sign = (speed_end >= speed_start) ? 1 : -1;
+    ramp->jerk = max_jerk;
+
+    /* Maximum acceleration is not reached on small speed changes */
+    ramp->acc = MIN(max_acc, sqrt(delta * max_jerk));
+
+    if (ramp->acc > 0) {
+        ramp->jerk_time = ramp->acc / max_jerk;
+        ramp->acc_time = MAX(0, delta / ramp->acc - ramp->jerk_time);
+    }
+    else {
+        ramp->jerk_time = 0;
+        ramp->acc_time = 0;
+    }
+
+    ramp->duration = 2 * ramp->jerk_time + ramp->acc_time;
+    ramp->distance = (speed_start + speed_end) / 2 * ramp->duration;
+}
+
+/* Distance and speed at time t since ramp start */
+static void motion_ramp_eval(const motion_ramp_t *ramp, double t,
+                             double *position, double *speed)
+{
+    double tj = ramp->jerk_time;
+    double ta = ramp->acc_time;
+    double j = ramp->sign * ramp->jerk;
+    double a = ramp->sign * ramp->acc;
+    /* Speed and distance at end of jerk and constant acceleration phases */
+    double v1 = ramp->speed_start + j * tj * tj / 2;
+    double s1 = ramp->speed_start * tj + j * tj * tj * tj / 6;
+    double v2 = v1 + a * ta;
+    double s2 = s1 + v1 * ta + a * ta * ta / 2;
+
+    t = MIN(MAX(t, 0), ramp->duration);
+
+    if (t < tj) {
+        *speed = ramp->speed_start + j * t * t / 2;
+        *position = ramp->speed_start * t + j * t * t * t / 6;
+    }
+    else if (t < tj + ta) {
+        t -= tj;
+        *speed = v1 + a * t;
+        *position = s1 + v1 * t + a * t * t / 2;
+    }
+    else {
+        t -= tj + ta;
+        *speed = v2 + a * t - j * t * t / 2;
+        *position = s2 + v2 * t + a * t * t / 2 - j * t * t * t / 6;
+    }
+}
+
+/* Distance needed to reach speed from speed_start and stop */
+static double motion_profile_distance(double speed_start, double speed,
+                                      double max_acc, double max_jerk)
+{
+    motion_ramp_t speed_up, slow_down;
+
+    motion_ramp_plan(&speed_up, speed_start, speed, max_acc, max_jerk);
+    motion_ramp_plan(&slow_down, speed, 0, max_acc, max_jerk);
+
+    return speed_up.distance + slow_down.distance;
+}
+
+void motion_profile_plan(motion_profile_t *profile, double distance,
+                         double speed_start, double max_speed,
+                         double max_acc, double max_jerk)
+{
+    double speed_min, speed_max;
+
+    profile->direction = (distance < 0) ? -1 : 1;
+    profile->distance = fabs(distance);
+    profile->time = 0;
+
+    /* Start from rest if going the other way */
+    max_speed = fabs(max_speed);
+    speed_start = MIN(MAX(speed_start * profile->direction, 0), max_speed);
+
+    /* Highest constant speed letting robot stop at segment end. If robot
+     * cannot stop in time at start speed, it only slows down. */
+    speed_min = speed_start;
+    speed_max = max_speed;
+    if (motion_profile_distance(speed_start, speed_max, max_acc, max_jerk) <= profile->distance) {
+        speed_min = speed_max;
+    }
+    for (int i = 0; (i < MOTION_PROFILE_SPEED_STEPS) && (speed_min < speed_max); i++) {
+        double speed = (speed_min + speed_max) / 2;
+
+        if (motion_profile_distance(speed_start, speed, max_acc, max_jerk) <= profile->distance) {
+            speed_min = speed;
+        }
+        else {
+            speed_max = speed;
+        }
+    }
+    profile->speed = speed_min;
+
+    motion_ramp_plan(&profile->speed_up, speed_start, profile->speed, max_acc, max_jerk);
+    motion_ramp_plan(&profile->slow_down, profile->speed, 0, max_acc, max_jerk);
+
+    profile->cruise_time = 0;
+    if (profile->speed > 0) {
+        profile->cruise_time = MAX(0, (profile->distance
+                                       - profile->speed_up.distance
+                                       - profile->slow_down.distance)
+                                      / profile->speed);
+    }
+
+    profile->duration = profile->speed_up.duration + profile->cruise_time
+                        + profile->slow_down.duration;
+}
+
+void motion_profile_update(motion_profile_t *profile, double dt,
+                           double *position, double *speed)
+{
+    double t;
+
+    profile->time = MIN(profile->time + dt, profile->duration);
+    t = profile->time;
+
+    if (t < profile->speed_up.duration) {
+        motion_ramp_eval(&profile->speed_up, t, position, speed);
+    }
+    else if (t < profile->speed_up.duration + profile->cruise_time) {
+        t -= profile->speed_up.duration;
+        *speed = profile->speed;
+        *position = profile->speed_up.distance + profile->speed * t;
+    }
+    else {
+        t -= profile->speed_up.duration + profile->cruise_time;
+        motion_ramp_eval(&profile->slow_down, t, position, speed);
+        *position += profile->speed_up.distance
+                     + profile->speed * profile->cruise_time;
+    }
+
+    *position = MIN(*position, profile->distance) * profile->direction;
+    *speed *= profile->direction;
+}
+
+uint8_t motion_profile_is_finished(const motion_profile_t *profile)
+{
+    return profile->time >= profile->duration;
+}
@@ -3,18 +3,207 @@
 #include "platform.h"
 #include "trigonometry.h"
 #include "obstacle.h"
+#include "utils.h"
 #include <math.h>
 
 /* RIOT includes */
 #define ENABLE_DEBUG        (0)
 #include "debug.h"
+#include "xtimer.h"
 
-/* Add a dynamic obstacle */
-int8_t add_dyn_obstacle(const uint16_t dev, const pose_t *robot_pose, double angle_offset, double distance_offset, double dist)
+/* Dynamic obstacle remembered between detections */
+typedef struct {
+    circle_t circle;        /* Obstacle shape given to avoidance */
+    int handle;             /* Avoidance dynamic polygon handle */
+    uint32_t timestamp;     /* Last detection time (us) */
+    uint8_t seen;           /* Detected since last update */
+} dyn_obstacle_t;
+
+/* Sensor detection, waiting to be fused with the other ones of the same
+ * sensors read */
+typedef struct {
+    pose_t point;           /* Detected point */
+    pose_t center;          /* Center of obstacle behind detected point */
+} dyn_hit_t;
+
+/* Maximum number of detections in a sensors read */
+#define OBSTACLE_DYN_HITS_MAX   8
+
+static dyn_hit_t dyn_hits[OBSTACLE_DYN_HITS_MAX];
+static uint8_t nb_dyn_hits = 0;
+
+static dyn_obstacle_t dyn_obstacles[OBSTACLE_DYN_MAX];
+static uint8_t nb_dyn_obstacles = 0;
+/* Avoidance obstacles changed since last update */
+static uint8_t dyn_obstacles_changed = FALSE;
+
+/* Refresh a known obstacle matching the detection, move it if needed.
+ * Return TRUE if a known obstacle matched. */
+static uint8_t refresh_dyn_obstacle(circle_t *circle)
+{
+    for (int i = 0; i < nb_dyn_obstacles; i++) {
+        dyn_obstacle_t *obstacle = &dyn_obstacles[i];
+        double distance = distance_points(&obstacle->circle.center, &circle->center);
+
+        if (distance >= OBSTACLE_DYN_MATCH_DISTANCE) {
+            continue;
+        }
+
+        /* First detection in this cycle gives obstacle position */
+        if ((!obstacle->seen)
+            && ((distance > OBSTACLE_DYN_MOVE_TOLERANCE)
+                || (fabs(obstacle->circle.radius - circle->radius) > OBSTACLE_DYN_MOVE_TOLERANCE))) {
+            obstacle->circle = *circle;
+            update_dyn_circle(obstacle->handle, circle);
+            dyn_obstacles_changed = TRUE;
+        }
+        obstacle->seen = TRUE;
+        obstacle->timestamp = xtimer_now_usec();
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Store a new obstacle */
+static int8_t store_dyn_obstacle(circle_t *circle)
+{
+    int handle;
+
+    if (nb_dyn_obstacles >= OBSTACLE_DYN_MAX) {
+        return -1;
+    }
+
+    handle = add_dyn_circle(circle);
+    if (handle < 0) {
+        return -1;
+    }
+
+    dyn_obstacles[nb_dyn_obstacles++] = (dyn_obstacle_t){
+        .circle = *circle,
+        .handle = handle,
+        .timestamp = xtimer_now_usec(),
+        .seen = TRUE,
+    };
+    dyn_obstacles_changed = TRUE;
+
+    return 0;
+}
+
+/* Fuse detections of cluster into a single circle obstacle, centered on
+ * their obstacles centers and containing all of them */
+static void fuse_dyn_hits(const uint8_t *cluster, uint8_t label)
+{
+    circle_t circle = { .center = { .x = 0, .y = 0, .O = 0 }, .radius = 0 };
+    uint8_t count = 0;
+    uint8_t collision = TRUE;
+
+    for (int i = 0; i < nb_dyn_hits; i++) {
+        if (cluster[i] != label) {
+            continue;
+        }
+        circle.center.x += dyn_hits[i].center.x;
+        circle.center.y += dyn_hits[i].center.y;
+        count++;
+    }
+
+    if (count == 0) {
+        return;
+    }
+    circle.center.x /= count;
+    circle.center.y /= count;
+
+    for (int i = 0; i < nb_dyn_hits; i++) {
+        if (cluster[i] == label) {
+            circle.radius = MAX(circle.radius, distance_points(&circle.center, &dyn_hits[i].center));
+        }
+    }
+    circle.radius += OBSTACLE_DYN_SIZE / 2;
+
+    /* Already known obstacle */
+    if (refresh_dyn_obstacle(&circle)) {
+        return;
+    }
+
+    /* Ignore new obstacle if all its points are outside borders or inside
+     * an other obstacle */
+    for (int i = 0; i < nb_dyn_hits; i++) {
+        if (cluster[i] == label) {
+            collision = collision && check_polygon_collision(&dyn_hits[i].point);
+        }
+    }
+    if (collision) {
+        return;
+    }
+
+    store_dyn_obstacle(&circle);
+}
+
+/* Group detections of last sensors read closer than
+ * OBSTACLE_DYN_CLUSTER_DISTANCE and store one obstacle per group */
+static void cluster_dyn_hits(void)
+{
+    uint8_t cluster[OBSTACLE_DYN_HITS_MAX];
+
+    for (int i = 0; i < nb_dyn_hits; i++) {
+        cluster[i] = i;
+        for (int j = 0; j < i; j++) {
+            uint8_t label = cluster[i];
+            if ((cluster[j] == label)
+                || (distance_points(&dyn_hits[i].point, &dyn_hits[j].point) >= OBSTACLE_DYN_CLUSTER_DISTANCE)) {
+                continue;
+            }
+            /* Merge clusters */
+            for (int k = 0; k <= i; k++) {
+                if (cluster[k] == label) {
+                    cluster[k] = cluster[j];
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < nb_dyn_hits; i++) {
+        if (cluster[i] == i) {
+            fuse_dyn_hits(cluster, i);
+        }
+    }
+
+    nb_dyn_hits = 0;
+}
+
+/* Fuse detections of last sensors read and forget obstacles not detected for
+ * too long. Avoidance obstacles are updated one by one.
+ * Return TRUE if avoidance obstacles changed. */
+uint8_t update_dyn_obstacles(void)
 {
-    polygon_t polygon;
-    uint8_t nb_vertices;
+    uint32_t now;
+
+    cluster_dyn_hits();
+
+    now = xtimer_now_usec();
+
+    for (int i = nb_dyn_obstacles - 1; i >= 0; i--) {
+        dyn_obstacles[i].seen = FALSE;
+        if ((now - dyn_obstacles[i].timestamp) > (OBSTACLE_DYN_LIFETIME_MS * US_PER_MS)) {
+            remove_dyn_polygon(dyn_obstacles[i].handle);
+            dyn_obstacles[i] = dyn_obstacles[--nb_dyn_obstacles];
+            dyn_obstacles_changed = TRUE;
+        }
+    }
+
+    if (!dyn_obstacles_changed) {
+        return FALSE;
+    }
 
+    dyn_obstacles_changed = FALSE;
+
+    return TRUE;
+}
+
+/* Add a dynamic obstacle detection */
+int8_t add_dyn_obstacle(const uint16_t dev, const pose_t *robot_pose, double angle_offset, double distance_offset, double dist)
+{
     pose_t robot_pose_tmp = *robot_pose;
     robot_pose_tmp.O += angle_offset;
     robot_pose_tmp.O = (int16_t)robot_pose_tmp.O % 360;
@@ -26,48 +215,25 @@ int8_t add_dyn_obstacle(const uint16_t dev, const pose_t *robot_pose, double ang
                                      .y = robot_pose_tmp.y + dist * sin(angle),
                                      .O = angle };
 
-    if (check_polygon_collision(&obstacle_point)) {
+    if (!is_point_in_polygon(&obstacle_borders, obstacle_point)) {
         goto add_dyn_obstacle_error_obstacle_borders;
     }
 
-    polygon.count = 0;
-    nb_vertices = 4;
-    if (nb_vertices < POLY_MAX_POINTS) {
-        /* Right reference*/
-        pose_t ref_pos_right = (pose_t){.x = robot_pose_tmp.x + OBSTACLE_DYN_SIZE / 2 * cos(angle - M_PI / 2),
-                                        .y = robot_pose_tmp.y + OBSTACLE_DYN_SIZE / 2 * sin(angle - M_PI / 2),
-                                        .O = angle /* + direction * M_PI/2 */ };
-        /* Left reference */
-        pose_t ref_pos_left = (pose_t){.x = robot_pose_tmp.x + OBSTACLE_DYN_SIZE / 2 * cos(angle + M_PI / 2),
-                                       .y = robot_pose_tmp.y + OBSTACLE_DYN_SIZE / 2 * sin(angle + M_PI / 2),
-                                       .O = angle /* + direction * M_PI/2 */ };
-
-        /* Right points */
-        polygon.points[polygon.count] = (pose_t){.x = ref_pos_right.x + dist * cos(ref_pos_right.O),
-                                                 .y = ref_pos_right.y + dist * sin(ref_pos_right.O) };
-        polygon.count++;
-        polygon.points[polygon.count] = (pose_t){.x = ref_pos_right.x + (dist + OBSTACLE_DYN_SIZE) * cos(ref_pos_right.O),
-                                                 .y = ref_pos_right.y + (dist + OBSTACLE_DYN_SIZE) * sin(ref_pos_right.O) };
-        polygon.count++;
-
-        /* Left points */
-        polygon.points[polygon.count] = (pose_t){.x = ref_pos_left.x + (dist + OBSTACLE_DYN_SIZE) * cos(ref_pos_left.O),
-                                                 .y = ref_pos_left.y + (dist + OBSTACLE_DYN_SIZE) * sin(ref_pos_left.O) };
-        polygon.count++;
-        polygon.points[polygon.count] = (pose_t){.x = ref_pos_left.x + dist * cos(ref_pos_left.O),
-                                                 .y = ref_pos_left.y + dist * sin(ref_pos_left.O) };
-        polygon.count++;
-        DEBUG("@obstacle@,%u, %+.0f,%+.0f,%+.0f,%+.0f,%+.0f,%+.0f,%+.0f,%+.0f,%+.0f\n", dev, polygon.points[0].x, polygon.points[0].y, polygon.points[1].x, polygon.points[1].y, polygon.points[2].x, polygon.points[2].y, polygon.points[3].x, polygon.points[3].y, robot_pose_tmp.O);
-        DEBUG("@t@,%+.0f,%+.0f,%+.0f,%+.0f\n", ref_pos_right.x, ref_pos_right.y, ref_pos_left.x, ref_pos_left.y);
-        add_dyn_polygon(&polygon);
-    }
-    else {
-        goto add_dyn_obstacle_error_nb_vertices;
+    if (nb_dyn_hits >= OBSTACLE_DYN_HITS_MAX) {
+        goto add_dyn_obstacle_error_full;
     }
 
+    /* Obstacle is stored once fused with other detections of the same
+     * sensors read, see update_dyn_obstacles() */
+    dyn_hits[nb_dyn_hits].point = obstacle_point;
+    dyn_hits[nb_dyn_hits].center = (pose_t){.x = robot_pose_tmp.x + (dist + OBSTACLE_DYN_SIZE / 2) * cos(angle),
+                                            .y = robot_pose_tmp.y + (dist + OBSTACLE_DYN_SIZE / 2) * sin(angle) };
+    DEBUG("Sensor %u hit: %+.0f,%+.0f\n", dev, obstacle_point.x, obstacle_point.y);
+    nb_dyn_hits++;
+
     return 0;
 
-add_dyn_obstacle_error_nb_vertices:
+add_dyn_obstacle_error_full:
 add_dyn_obstacle_error_obstacle_borders:
     return -1;
 }
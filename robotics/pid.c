@@ -13,7 +13,7 @@ void pid_reset(PID_t *pid)
     pid->ti = 0;
 }
 
-double pid_ctrl(PID_t *pid, const double error)
+double pid_ctrl(PID_t *pid, const double error, const double dt)
 {
     double p, i, d;
 
@@ -21,7 +21,7 @@ double pid_ctrl(PID_t *pid, const double error)
     p = error * pid->kp;
 
     /* integral */
-    pid->ti += error;   /* error sum */
+    pid->ti += error * dt;   /* error sum */
 
     /* integral limitation */
     if (pid->ti > INTEGRAL_LIMIT) {
@@ -34,7 +34,7 @@ double pid_ctrl(PID_t *pid, const double error)
     i = pid->ti * pid->ki;
 
     /* derivative */
-    d = error - pid->previous_error;
+    d = (error - pid->previous_error) / dt;
     d *= pid->kd;
     pid->previous_error = error;    /* backup the previous error */
 
@@ -0,0 +1,49 @@
+#include <assert.h>
+
+#include "range_filter.h"
+#include "utils.h"
+
+void range_filter_setup(range_filter_t *filter, const range_filter_conf_t *conf)
+{
+    assert((conf->size > 0) && (conf->size <= RANGE_FILTER_MAX_SIZE));
+
+    filter->conf = conf;
+    range_filter_reset(filter);
+}
+
+void range_filter_reset(range_filter_t *filter)
+{
+    filter->index = 0;
+    filter->count = 0;
+    filter->detected = FALSE;
+}
+
+uint8_t range_filter_update(range_filter_t *filter, const range_sample_t *sample,
+                            range_sample_t *filtered)
+{
+    const range_filter_conf_t *conf = filter->conf;
+    range_sample_t sorted[RANGE_FILTER_MAX_SIZE];
+    uint16_t max;
+
+    /* Replace oldest sample */
+    filter->samples[filter->index] = *sample;
+    filter->index = (filter->index + 1) % conf->size;
+    filter->count = MIN(filter->count + 1, conf->size);
+
+    /* Insertion sort of the window, bounded by RANGE_FILTER_MAX_SIZE */
+    for (int i = 0; i < filter->count; i++) {
+        int j = i;
+        for (; (j > 0) && (sorted[j - 1].distance > filter->samples[i].distance); j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = filter->samples[i];
+    }
+    *filtered = sorted[(filter->count - 1) / 2];
+
+    /* Detected obstacle is kept a bit further than a new one is detected */
+    max = filter->detected ? conf->max + conf->hysteresis : conf->max;
+    filter->detected = (filtered->distance > conf->min)
+                       && (filtered->distance < max);
+
+    return filter->detected;
+}